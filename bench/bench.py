@@ -0,0 +1,214 @@
+#!/usr/bin/python3
+# coding: utf-8
+
+# Benchmarks the pass on the samples and on the synthetic modules from generate.py. Each module is
+# analysed once for each fixpoint strategy (i.e. combination of -painpass-algorithm and
+# -painpass-schedule). For each function, the pass reports wall time, the number of worklist
+# iterations and the number of calls to the transfer function (see -painpass-stats). The summary also
+# counts the functions that exceeded the iteration budget. The peak memory is measured for the whole
+# opt process, so it is the same for all functions of a module.
+#  The results are written as JSON lines, one object per function and strategy, tagged with the
+# current commit. This way, results of different commits can just be concatenated and compared.
+
+import argparse
+import json
+import os
+import platform
+import shlex
+import subprocess
+import sys
+import time
+
+import generate
+
+if sys.version_info[0] < 3:
+    print("Error: This script only supports Python 3")
+    sys.exit(5)
+
+bench_dir = os.path.abspath(os.path.dirname(sys.argv[0]))
+project_dir = os.path.dirname(bench_dir)
+os.chdir(project_dir)
+
+if not os.path.isfile(".config"):
+    print("No config file was found. Please run init.py first!")
+    sys.exit(-1)
+
+config_file = open(".config", "r")
+lines = config_file.readlines()
+llvm_path = lines[1].strip()
+clang_path = lines[2].strip()
+config_file.close()
+
+opt = llvm_path + '/bin/opt'
+llvm_dis = llvm_path + '/bin/llvm-dis'
+clang = clang_path + '/bin/clang'
+
+if platform.system() == 'Linux':
+    libeext = '.so'
+elif platform.system() == 'Darwin':
+    libeext = '.dylib'
+else:
+    print('Error: Unsupported platform ' + platform.system())
+    sys.exit(4)
+
+pass_lib = llvm_path + "/lib/llvm-pain" + libeext
+pass_name = "painpass"
+
+samples = project_dir + '/samples'
+output_dir = project_dir + '/output/bench'
+
+# The strategies that are run by default, as algorithm:schedule. (The sparse algorithm does not use
+# a schedule.)
+strategies_default = [
+    'simple:lifo', 'simple:rpo', 'widening:lifo', 'widening:wto', 'widening:rpo', 'sparse',
+]
+
+def main():
+    def run(arg, redirect=None):
+        if args.only_print:
+            cmd = ' '.join(shlex.quote(i) for i in arg)
+            if redirect:
+                cmd += ' > %s 2>&1' % (shlex.quote(redirect),)
+            print('    ' + cmd)
+            return
+        try:
+            if redirect:
+                with open(redirect, 'w') as f:
+                    subprocess.run(arg, stdout=f, stderr=f, check=True)
+            else:
+                subprocess.run(arg, check=True)
+        except subprocess.CalledProcessError as e:
+            print('Error: while executing ' + str(e.cmd))
+            sys.exit(3)
+
+    # Runs opt on the module, returns the wall time in seconds and the peak memory in KiB
+    def run_measured(arg):
+        if args.only_print:
+            print('    ' + ' '.join(shlex.quote(i) for i in arg) + ' > /dev/null 2>&1')
+            return 0, 0
+        time_start = time.perf_counter()
+        proc = subprocess.Popen(arg, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        _, status, usage = os.wait4(proc.pid, 0)
+        seconds = time.perf_counter() - time_start
+        if status != 0:
+            print('Error: while executing ' + ' '.join(shlex.quote(i) for i in arg))
+            sys.exit(3)
+        # ru_maxrss is in KiB on Linux, but in bytes on macOS
+        rss = usage.ru_maxrss // 1024 if platform.system() == 'Darwin' else usage.ru_maxrss
+        return seconds, rss
+
+    parser = argparse.ArgumentParser(description='Benchmark the pass on the samples and on generated modules.')
+    parser.add_argument("file", help="benchmark only the specified samples (.c) or modules (.ll)", nargs='*')
+    parser.add_argument("-n", dest='only_print', help="only print the commands, do not execute anything", action="store_true")
+    parser.add_argument("-o", dest='output', metavar='file', help="append the results to this file (default: output/bench/<commit>.jsonl)")
+    parser.add_argument("-r", dest='repeat', metavar='n', type=int, default=3, help="run each strategy n times, report the fastest (default: 3)")
+    parser.add_argument("-s", dest='strategies', metavar='strategy', action='append', help="run only this strategy, as algorithm[:schedule] (can be given multiple times)")
+    parser.add_argument("--threads", metavar='n', type=int, default=1, help="passed on as -painpass-threads (default: 1)")
+    parser.add_argument("--no-samples", dest='no_samples', help="do not benchmark the samples", action="store_true")
+    parser.add_argument("--no-generated", dest='no_generated', help="do not benchmark the generated modules", action="store_true")
+    parser.add_argument("--pass-lib", metavar='path', dest='pass_lib', help="use this build of the pass (default: %s)" % (pass_lib,))
+    parser.add_argument("--opt-args", metavar='args', dest='opt_args', default='', help="additional arguments for opt")
+    args = parser.parse_args()
+
+    lib = args.pass_lib or pass_lib
+    strategies = args.strategies or strategies_default
+
+    if not os.path.isfile(opt):
+        print('Error: no opt exists at ' + opt + ' (maybe you forgot to build LLVM?)')
+        sys.exit(2)
+    if not os.path.isfile(lib):
+        print('Error: Could not find shared library ' + lib)
+        print('Please build the project (for example by running run.py with the option --make')
+        sys.exit(7)
+
+    os.makedirs(output_dir, exist_ok=True)
+
+    # Collect the modules to analyse, compiling the samples to LLVM IR the same way run.py does
+    modules = []
+    files = args.file
+    if not files:
+        if not args.no_samples:
+            files += sorted(i for i in os.listdir(samples) if i.endswith('.c'))
+        if not args.no_generated:
+            files += [i for i, _, _ in generate.modules]
+
+    for fname in files:
+        if fname.endswith('.c'):
+            f_orig  = 'samples/%s' % (fname,)
+            f_bc    = '%s/%s-tmp.bc' % (output_dir, fname)
+            f_optbc = '%s/%s.bc' % (output_dir, fname)
+            f_optll = '%s/%s.ll' % (output_dir, fname)
+            if not os.path.isfile(f_orig):
+                print("Error: " + f_orig + " not found!")
+                continue
+            if not os.path.isfile(clang):
+                print('Error: no clang exists at ' + clang)
+                sys.exit(2)
+            run([clang, '-O0', '-emit-llvm', f_orig, '-Xclang', '-disable-O0-optnone', '-c', '-o', f_bc])
+            run([opt, '-mem2reg', f_bc, '-o', f_optbc])
+            run([llvm_dis, f_optbc, '-o', f_optll])
+            run(['rm', f_bc, f_optbc])
+            modules.append((fname, f_optll))
+        else:
+            gens = [(gen, arg) for name, gen, arg in generate.modules if name == fname]
+            if not gens:
+                print("Error: unknown generated module " + fname)
+                continue
+            gen, arg = gens[0]
+            f_ll = '%s/%s' % (output_dir, fname)
+            if not args.only_print:
+                with open(f_ll, 'w') as f:
+                    f.write(gen(arg))
+            modules.append((fname, f_ll))
+
+    commit = subprocess.run(['git', 'rev-parse', '--short', 'HEAD'], stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL).stdout.decode('ascii').strip() or 'unknown'
+    f_results = args.output or '%s/%s.jsonl' % (output_dir, commit)
+    f_stats = '%s/stats.jsonl' % (output_dir,)
+
+    results = []
+    if not args.only_print:
+        print('%-24s %-14s %9s %12s %14s %10s %9s' % ('module', 'strategy', 'seconds', 'iterations', 'transfer calls', 'peak KiB', 'exceeded'))
+    for module, f_ll in modules:
+        for strategy in strategies:
+            algorithm, _, schedule = strategy.partition(':')
+            opt_args = ['-load', lib, '-'+pass_name, '-painpass-algorithm=' + algorithm,
+                '-painpass-debug-level=0', '-painpass-threads=%d' % (args.threads,), '-painpass-stats=' + f_stats]
+            if schedule:
+                opt_args.append('-painpass-schedule=' + schedule)
+            cmd = [opt] + shlex.split(args.opt_args) + opt_args + ['-o', '/dev/null', f_ll]
+
+            # The counters do not change between runs, so we just keep the fastest time for each function
+            best = {}
+            best_seconds = best_rss = None
+            for _ in range(args.repeat):
+                seconds, rss = run_measured(cmd)
+                if args.only_print: break
+                best_seconds = seconds if best_seconds is None else min(best_seconds, seconds)
+                best_rss = rss if best_rss is None else min(best_rss, rss)
+                with open(f_stats, 'r') as f:
+                    for line in f:
+                        stat = json.loads(line)
+                        prev = best.get(stat['function'])
+                        if prev is None or stat['seconds'] < prev['seconds']:
+                            best[stat['function']] = stat
+            if args.only_print: continue
+
+            for stat in best.values():
+                results.append(dict(commit=commit, module=module, strategy=strategy, **stat,
+                    module_seconds=round(best_seconds, 6), peak_rss_kib=best_rss))
+
+            print('%-24s %-14s %9.4f %12d %14d %10d %9d' % (module, strategy,
+                sum(i['seconds'] for i in best.values()), sum(i['iterations'] for i in best.values()),
+                sum(i['transfer_calls'] for i in best.values()), best_rss,
+                sum(i['budget_exceeded'] for i in best.values())))
+
+    if args.only_print: return
+
+    with open(f_results, 'a') as f:
+        for i in results:
+            f.write(json.dumps(i) + '\n')
+    print('Wrote %d results to %s' % (len(results), f_results))
+
+if __name__ == "__main__":
+    main()
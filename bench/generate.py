@@ -0,0 +1,159 @@
+#!/usr/bin/python3
+# coding: utf-8
+
+# Generates large synthetic LLVM IR modules for benchmarking the pass. Each kind of module stresses a
+# different part of the analysis:
+#   loops:    deeply nested counting loops, which need many rounds of widening and narrowing
+#   switch:   wide switches, with a merge block that has a predecessor for each case
+#   straight: long basic blocks, to measure the cost of the transfer functions
+#   many:     many small functions, to measure the per-function overhead (and threading)
+# The generated IR only uses integer operations, so it does not depend on the LLVM version much.
+
+import argparse
+import os
+import sys
+
+def gen_loops(depth):
+    # for (i0 = 0; i0 < 10; ++i0) for (i1 = 0; i1 < 11; ++i1) ... acc = acc * 3 + i0 + ... + in
+    name = 'loops_%d' % (depth,)
+    out = ['define i32 @%s(i32 %%n) {' % (name,), 'entry:', '  br label %cond0']
+    for d in range(depth):
+        outer_acc = '%%acc%d' % (d-1,) if d > 0 else '0'
+        outer_body = 'body%d' % (d-1,) if d > 0 else 'entry'
+        out += [
+            'cond%d:' % (d,),
+            '  %%i%d = phi i32 [ 0, %%%s ], [ %%inc%d, %%latch%d ]' % (d, outer_body, d, d),
+            '  %%acc%d = phi i32 [ %s, %%%s ], [ %%acc%d.next, %%latch%d ]' % (d, outer_acc, outer_body, d, d),
+            '  %%cmp%d = icmp slt i32 %%i%d, %d' % (d, d, 10 + d),
+            '  br i1 %%cmp%d, label %%body%d, label %%end%d' % (d, d, d),
+            'body%d:' % (d,),
+        ]
+        if d+1 < depth:
+            out.append('  br label %%cond%d' % (d+1,))
+    # The innermost body does the actual work
+    d = depth - 1
+    out += [
+        '  %%mul = mul nsw i32 %%acc%d, 3' % (d,),
+        '  %sum0 = add nsw i32 %mul, %i0',
+    ]
+    for k in range(1, depth):
+        out.append('  %%sum%d = add nsw i32 %%sum%d, %%i%d' % (k, k-1, k))
+    out += [
+        '  %%rem = srem i32 %%sum%d, 1000007' % (depth-1,),
+        '  br label %%latch%d' % (d,),
+    ]
+    for d in reversed(range(depth)):
+        inner = '%rem' if d == depth-1 else '%%acc%d' % (d+1,)
+        out += [
+            'latch%d:' % (d,),
+            '  %%acc%d.next = phi i32 [ %s, %%%s ]' % (d, inner, 'body%d' % (d,) if d == depth-1 else 'end%d' % (d+1,)),
+            '  %%inc%d = add nsw i32 %%i%d, 1' % (d, d),
+            '  br label %%cond%d' % (d,),
+            'end%d:' % (d,),
+        ]
+        if d > 0:
+            out.append('  br label %%latch%d' % (d-1,))
+    out += ['  ret i32 %acc0', '}', '']
+    return '\n'.join(out)
+
+def gen_switch(cases):
+    name = 'switch_%d' % (cases,)
+    out = [
+        'define i32 @%s(i32 %%x, i32 %%y) {' % (name,),
+        'entry:',
+        '  %%sel = urem i32 %%x, %d' % (cases,),
+        '  switch i32 %sel, label %default [',
+    ]
+    out += ['    i32 %d, label %%case%d' % (i, i) for i in range(cases)]
+    out += ['  ]']
+    for i in range(cases):
+        out += [
+            'case%d:' % (i,),
+            '  %%a%d = add nsw i32 %%sel, %d' % (i, i*7),
+            '  %%b%d = mul nsw i32 %%a%d, %d' % (i, i, i % 5 + 1),
+            '  br label %merge',
+        ]
+    out += [
+        'default:',
+        '  br label %merge',
+        'merge:',
+        '  %r = phi i32 ' + ', '.join(['[ %%b%d, %%case%d ]' % (i, i) for i in range(cases)] + ['[ 0, %default ]']),
+        '  %cmp = icmp ult i32 %r, %y',
+        '  br i1 %cmp, label %small, label %large',
+        'small:',
+        '  ret i32 %r',
+        'large:',
+        '  %s = sub i32 %r, %y',
+        '  ret i32 %s',
+        '}',
+        '',
+    ]
+    return '\n'.join(out)
+
+def gen_straight(length):
+    name = 'straight_%d' % (length,)
+    out = ['define i32 @%s(i32 %%a, i32 %%b) {' % (name,), 'entry:', '  %v0 = add i32 %a, 0']
+    ops = ['add nsw', 'sub', 'mul', 'add nuw', 'urem', 'srem']
+    for i in range(1, length):
+        op = ops[i % len(ops)]
+        rhs = '%%v%d' % (i//2,) if op in ('add nsw', 'sub') else str(i % 97 + 1)
+        out.append('  %%v%d = %s i32 %%v%d, %s' % (i, op, i-1, rhs))
+    out += [
+        '  %%cmp = icmp slt i32 %%v%d, %%b' % (length-1,),
+        '  br i1 %cmp, label %then, label %else',
+        'then:',
+        '  ret i32 %%v%d' % (length-1,),
+        'else:',
+        '  ret i32 %b',
+        '}',
+        '',
+    ]
+    return '\n'.join(out)
+
+def gen_many(count):
+    out = []
+    for f in range(count):
+        out += [
+            'define i32 @many_%d(i32 %%n) {' % (f,),
+            'entry:',
+            '  br label %cond',
+            'cond:',
+            '  %i = phi i32 [ 0, %entry ], [ %inc, %body ]',
+            '  %x = phi i32 [ %n, %entry ], [ %x.next, %body ]',
+            '  %%cmp = icmp slt i32 %%i, %d' % (f % 50 + 1,),
+            '  br i1 %cmp, label %body, label %end',
+            'body:',
+            '  %%x.next = add nsw i32 %%x, %d' % (f % 7 + 1,),
+            '  %inc = add nsw i32 %i, 1',
+            '  br label %cond',
+            'end:',
+            '  ret i32 %x',
+            '}',
+            '',
+        ]
+    return '\n'.join(out)
+
+# The modules that are generated by default, as (file name, generator, argument)
+modules = [
+    ('loops-4.ll',       gen_loops,    4),
+    ('loops-8.ll',       gen_loops,    8),
+    ('switch-64.ll',     gen_switch,   64),
+    ('switch-512.ll',    gen_switch,   512),
+    ('straight-1000.ll', gen_straight, 1000),
+    ('straight-8000.ll', gen_straight, 8000),
+    ('many-500.ll',      gen_many,     500),
+]
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate synthetic LLVM IR modules for benchmarking.')
+    parser.add_argument('outdir', help='directory to write the .ll files into')
+    args = parser.parse_args()
+
+    os.makedirs(args.outdir, exist_ok=True)
+    for fname, gen, arg in modules:
+        with open(os.path.join(args.outdir, fname), 'w') as f:
+            f.write(gen(arg))
+        print(os.path.join(args.outdir, fname))
+
+if __name__ == '__main__':
+    main()
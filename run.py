@@ -96,12 +96,13 @@ def main():
     parser.add_argument("--only-make", dest='do_make_only', help="only call make, do not execute any samples", action="store_true")
     parser.add_argument("--gdb", dest='do_gdb', help="open the debugger for the specified file", action="store_true")
     parser.add_argument("--run-test", dest='run_test', help="run the test for SimpleInterval", action="store_true")
+    parser.add_argument("--run-bench", dest='run_bench', help="run the microbenchmark for SimpleInterval", action="store_true")
     parser.add_argument("--use-cxx", metavar='path', dest='use_cxx', help="use as c++ compiler when building the test")
     args = parser.parse_args()
 
     # If no files are specified, set it to all .c files in current directory
     files = args.file
-    if args.run_test:
+    if args.run_test or args.run_bench:
         if files:
             print('Error: you are trying to both run the test and a file. This does not really make sense.')
             sys.exit(4)
@@ -113,6 +114,7 @@ def main():
         args.do_make = True
         files = []
         args.run_test = False
+        args.run_bench = False
     elif not files:
         files = [i for i in os.listdir(samples) if i.endswith('.c')]
 
@@ -158,7 +160,7 @@ def main():
                 print('In a moment, gdb is going to read in the symbols of opt. As you might notice, that takes a long time. So, here is a tip: Just restart the program using r (no need to specify arguments). Even if you rebuild the project, that is in a shared library and will thus be reloaded the next time you start the program.')
             run([gdb, '-q',  opt, '-ex', 'r ' + ' '.join(map(shlex.quote, base_args))])
 
-    if args.run_test:
+    if args.run_test or args.run_bench:
         if not os.path.isfile(llvm_config):
             print('Error: no llvm-config exists at ' + llvm_config + ' (maybe you forgot to build LLVM?)')
             sys.exit(2)
@@ -178,7 +180,8 @@ def main():
             libs += '-lz -ldl -lpthread -lm -lcurses'.split()
         else:
             libs += '-lz -lrt -ldl -ltinfo -lpthread -lm'.split()
-        
+
+    if args.run_test:
         run([cxx, 'test/simple_interval_test.cpp', 'src/simple_interval.cpp', '-Isrc', '-fmax-errors=2'] + cxxflags
              + ['-o', 'build/SimpleIntervalTest'] + ldflags + libs)
 
@@ -186,6 +189,12 @@ def main():
             run(['build/SimpleIntervalTest'])
         except KeyboardInterrupt:
             pass
+
+    if args.run_bench:
+        # The benchmark is always optimised and without assertions, regardless of how LLVM was built
+        run([cxx, 'test/simple_interval_bench.cpp', 'src/simple_interval.cpp', '-Isrc', '-fmax-errors=2'] + cxxflags
+             + ['-O2', '-DNDEBUG', '-o', 'build/SimpleIntervalBench'] + ldflags + libs)
+        run(['build/SimpleIntervalBench'])
         
 if __name__ == "__main__":
     main()
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/CFG.h"
+
+namespace pcpo {
+
+// The control flow graph of a function, as used by the fixpoint drivers. The basic blocks get dense
+// ids, in the order of the function (so the entry block is 0), and the predecessors and successors
+// of each block are stored as ids in two flat arrays (compressed sparse rows). This is built once per
+// function, so that the iteration does not need to walk the use lists of the blocks or look up their
+// ids in a hash map every time.
+//  The predecessors are in the same order as llvm::predecessors, which AbstractState::apply relies
+// on. Like there, a block is listed multiple times if it has multiple edges (e.g. from a switch),
+// and the same goes for the successors. BlockT is either llvm::BasicBlock or llvm::BasicBlock const,
+// depending on which one the driver uses.
+template <typename BlockT>
+class ControlFlowGraph {
+public:
+    template <typename FunctionT>
+    explicit ControlFlowGraph(FunctionT& f) {
+        for (BlockT& bb: f) {
+            ids[&bb] = blocks.size();
+            blocks.push_back(&bb);
+        }
+
+        pred_offsets.push_back(0);
+        succ_offsets.push_back(0);
+        for (BlockT* bb: blocks) {
+            for (BlockT* pred: llvm::predecessors(bb)) preds.push_back(ids.lookup(pred));
+            for (BlockT* succ: llvm::successors(bb))   succs.push_back(ids.lookup(succ));
+            pred_offsets.push_back(preds.size());
+            succ_offsets.push_back(succs.size());
+        }
+    }
+
+    int size() const { return blocks.size(); }
+    BlockT* block(int id) const { return blocks[id]; }
+
+    // This needs a lookup in a hash map, so better not use it while iterating
+    int id(BlockT const& bb) const { return ids.lookup(&bb); }
+
+    llvm::ArrayRef<int> predecessors(int id) const {
+        return {preds.data() + pred_offsets[id], preds.data() + pred_offsets[id + 1]};
+    }
+    llvm::ArrayRef<int> successors(int id) const {
+        return {succs.data() + succ_offsets[id], succs.data() + succ_offsets[id + 1]};
+    }
+
+private:
+    std::vector<BlockT*> blocks; // Maps the ids back to the blocks
+    llvm::DenseMap<BlockT const*, int> ids;
+
+    // The predecessors of block i are preds[pred_offsets[i]] up to preds[pred_offsets[i+1]], and the
+    // same for the successors.
+    std::vector<int> pred_offsets;
+    std::vector<int> preds;
+    std::vector<int> succ_offsets;
+    std::vector<int> succs;
+};
+
+} /* end of namespace pcpo */
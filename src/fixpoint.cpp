@@ -1,25 +1,160 @@
 #include "fixpoint.h"
 
-#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_os_ostream.h"
 
+#include "control_flow_graph.h"
 #include "global.h"
+#include "induction_ranges.h"
+#include "result_output.h"
 #include "fixpoint_widening.cpp"
+#include "fixpoint_sparse.cpp"
 #include "value_set.h"
+#include "parallel.h"
 #include "simple_interval.h"
+#include "statistics.h"
+#include "worklist.h"
+
+#define DEBUG_TYPE "painpass"
 
 namespace pcpo {
 
+STATISTIC(NumFunctions,      "Number of functions analysed");
+STATISTIC(NumBudgetExceeded, "Number of functions whose fixpoint iteration exceeded the budget");
+STATISTIC(NumIterations,     "Number of basic blocks processed (instructions for the sparse algorithm)");
+STATISTIC(NumTransferCalls,  "Number of calls to the transfer function");
+STATISTIC(NumWidenMerges,    "Number of merges using widening");
+STATISTIC(NumNarrowMerges,   "Number of merges using narrowing");
+STATISTIC(NumChangedMerges,  "Number of merges that changed the state of a basic block");
+
 static llvm::RegisterPass<AbstractInterpretationPass> Y("painpass", "AbstractInterpretation Pass");
 
 char AbstractInterpretationPass::ID;
 
 int debug_level = DEBUG_LEVEL; // from global.hpp
+thread_local llvm::raw_ostream* debug_stream = nullptr; // from global.hpp
+thread_local Counters counters; // from statistics.h
+bool profiling = false; // from statistics.h
+Output_format::Type output_format = Output_format::TEXT; // from result_output.h
+thread_local llvm::raw_ostream* result_stream = nullptr; // from result_output.h
+thread_local InductionRanges const* induction_ranges = nullptr; // from induction_ranges.h
+
+namespace Fixpoint_algorithm {
+
+enum Type: int {
+    SIMPLE, WIDENING, SPARSE
+};
+
+}
+
+static llvm::cl::opt<Fixpoint_algorithm::Type> fixpoint_algorithm {
+    "painpass-algorithm", llvm::cl::desc("Choose the fixpoint algorithm of the painpass"),
+    llvm::cl::values(
+        clEnumValN(Fixpoint_algorithm::SIMPLE,   "simple",   "simple fixpoint iteration, may not terminate"),
+        clEnumValN(Fixpoint_algorithm::WIDENING, "widening", "fixpoint iteration using widening and narrowing"),
+        clEnumValN(Fixpoint_algorithm::SPARSE,   "sparse",   "propagate changes along def-use chains, less precise")
+    ),
+    llvm::cl::init(Fixpoint_algorithm::WIDENING)
+};
+
+static llvm::cl::opt<Scheduling::Type> scheduling {
+    "painpass-schedule", llvm::cl::desc("Choose the order in which the painpass processes basic blocks"),
+    llvm::cl::values(
+        clEnumValN(Scheduling::LIFO, "lifo", "use a worklist, taking the block added last"),
+        clEnumValN(Scheduling::WTO,  "wto",  "follow a weak topological ordering (only with widening)"),
+        clEnumValN(Scheduling::RPO,  "rpo",  "use a worklist, taking the block first in reverse post-order")
+    ),
+    llvm::cl::init(Scheduling::WTO)
+};
+
+static llvm::cl::opt<int, true> debug_level_option {
+    "painpass-debug-level", llvm::cl::desc("Amount of debug output of the painpass (0 is just the result)"),
+    llvm::cl::location(debug_level), llvm::cl::init(DEBUG_LEVEL)
+};
+
+static llvm::cl::opt<int> iterations_base {
+    "painpass-iterations", llvm::cl::desc("Number of basic blocks processed per function, before values that do not stabilise are set to top"),
+    llvm::cl::init(1000)
+};
+
+static llvm::cl::opt<int> iterations_per_block {
+    "painpass-iterations-per-block", llvm::cl::desc("Added to -painpass-iterations for each basic block, and again for each loop containing it"),
+    llvm::cl::init(20)
+};
+
+static llvm::cl::opt<bool> use_thresholds {
+    "painpass-thresholds", llvm::cl::desc("Widen to the constants the function compares against first (see WideningThresholds)"),
+    llvm::cl::init(true)
+};
+
+static llvm::cl::opt<bool> use_scev {
+    "painpass-scev", llvm::cl::desc("Use the ranges ScalarEvolution finds for the induction variables of counted loops (see InductionRanges)"),
+    llvm::cl::init(false)
+};
+
+static llvm::cl::opt<int> narrowing_rounds {
+    "painpass-narrowing-rounds", llvm::cl::desc("Number of times each basic block is narrowed at most, with -painpass-algorithm=widening (0 for no limit)"),
+    llvm::cl::init(3)
+};
+
+static llvm::cl::opt<bool> prune_states {
+    "painpass-liveness", llvm::cl::desc("Drop values from the states once they are dead (except in the block defining them)"),
+    llvm::cl::init(false)
+};
+
+static llvm::cl::opt<int> thread_count {
+    "painpass-threads", llvm::cl::desc("Number of threads analysing functions in parallel (0 to use all cores)"),
+    llvm::cl::init(1)
+};
+
+static llvm::cl::opt<int, true> memo_size {
+    "painpass-memo-size", llvm::cl::desc("Number of entries in the cache for transfer functions, per thread (0 to disable)"),
+    llvm::cl::location(SimpleInterval::cache_size), llvm::cl::init(0)
+};
+
+static llvm::cl::opt<Output_format::Type, true> output_format_option {
+    "painpass-output", llvm::cl::desc("Choose how the painpass outputs its results"),
+    llvm::cl::values(
+        clEnumValN(Output_format::TEXT,  "text",  "the state leaving each basic block, after the debug output"),
+        clEnumValN(Output_format::JSONL, "jsonl", "one line of JSON per basic block, with the values it defines or refines"),
+        clEnumValN(Output_format::NONE,  "none",  "nothing")
+    ),
+    llvm::cl::location(output_format), llvm::cl::init(Output_format::TEXT)
+};
+
+static llvm::cl::opt<std::string> output_file {
+    "painpass-output-file", llvm::cl::desc("Write the results of -painpass-output=jsonl into the file instead of stderr"),
+    llvm::cl::value_desc("filename")
+};
+
+static llvm::cl::list<std::string> only_functions {
+    "painpass-functions", llvm::cl::desc("Only analyse and output the functions with these names"),
+    llvm::cl::CommaSeparated, llvm::cl::value_desc("name,...")
+};
+
+static llvm::cl::opt<std::string> stats_file {
+    "painpass-stats", llvm::cl::desc("Write statistics about each function as JSON lines into the file"),
+    llvm::cl::value_desc("filename")
+};
 
 class AbstractStateDummy {
 public:
@@ -32,8 +167,9 @@ public:
     AbstractStateDummy(AbstractStateDummy const& state) = default;
 
     // Initialise the state to the incoming state of the function. This should do something like
-    // assuming the parameters can be anything.
-    explicit AbstractStateDummy(llvm::Function const& f) {}
+    // assuming the parameters can be anything. The numbering is built once per function by the
+    // driver and stays alive for the whole fixpoint iteration, so the state may keep a pointer to it.
+    AbstractStateDummy(llvm::Function const& f, ValueNumbering const& numbering) {}
 
     // Applies the changes needed to reflect executing the instructions in the basic block. Before
     // this operation is called, the state is the one upon entering bb, afterwards it should be (an
@@ -52,11 +188,16 @@ public:
     //   3. NARROW: Return a value between the intersection of the state and other, and the
     //      state. In pseudocode:
     //          intersect(state, other) <= narrow(state, other) <= state
-    // For all of the above, this operation returns whether the state changed as a result.
-    // IMPORTANT: The simple fixpoint algorithm only performs UPPER_BOUND, so you do not need to
-    // implement the others if you just use that one. (The more advanced algorithm in
-    // fixpoint_widening.cpp uses all three operations.)
-    bool merge(Merge_op::Type op, AbstractStateDummy const& other) { return false; };
+    //   4. WIDEN_TOP: Same as UPPER_BOUND, but values that would change are set to top. The drivers
+    //      use this once a function exceeds its iteration budget, so that they still reach a
+    //      (sound, if imprecise) fixpoint quickly.
+    // For all of the above, this operation returns whether the state changed as a result. If
+    // changes is not null, the indices (in the ValueNumbering) of the values that changed are
+    // appended to it.
+    // IMPORTANT: The simple fixpoint algorithm only performs UPPER_BOUND (and WIDEN_TOP), so you do
+    // not need to implement the others if you just use that one. (The more advanced algorithm in
+    // fixpoint_widening.cpp uses all of them.)
+    bool merge(Merge_op::Type op, AbstractStateDummy const& other, std::vector<int>* changes = nullptr) { return false; };
 
     // Restrict the set of values to the one that allows 'from' to branch towards
     // 'towards'. Starting with the state when exiting from, this should compute (an upper bound of)
@@ -64,153 +205,393 @@ public:
     // implementation.
     void branch(llvm::BasicBlock const& from, llvm::BasicBlock const& towards) {};
 
+    // Drop all values except the ones with the given indices (in the ValueNumbering), which are in
+    // increasing order. With -painpass-liveness, the drivers call this after apply, passing the
+    // values that are live at the end of the block or defined in it (see Liveness). Doing nothing
+    // is a valid implementation, but the state must not lose the information that it is bottom.
+    void keepOnly(std::vector<int> const& ids) {};
+
     // Functions to generate the debug output. printIncoming should output the state as of entering
     // the basic block, printOutcoming the state when leaving it.
     void printIncoming(llvm::BasicBlock const& bb, llvm::raw_ostream& out, int indentation = 0) const {};
     void printOutgoing(llvm::BasicBlock const& bb, llvm::raw_ostream& out, int indentation = 0) const {};
+
+    // Output the state leaving bb for -painpass-output=jsonl, as a single line. Only the values
+    // defined in bb should be listed, and the ones that differ from the state leaving the block
+    // defining them, which is given by defining (indexed by the ValueNumbering). See ValueNames for
+    // the formatting.
+    void printOutgoingJson(
+        llvm::BasicBlock const& bb, llvm::raw_ostream& out,
+        std::vector<AbstractStateDummy const*> const& defining, ValueNames& names
+    ) const {};
+
+    // Return the number of values the state keeps track of. This is only used for the statistics.
+    int valueCount() const { return 0; }
 };
 
-// Run the simple fixpoint algorithm. AbstractState should implement the interface documented in
-// AbstractStateDummy (no need to subclass or any of that, just implement the methods with the right
-// signatures and take care to fulfil the contracts outlines above).
+// Run the simple fixpoint algorithm on a single function. AbstractState should implement the
+// interface documented in AbstractStateDummy (no need to subclass or any of that, just implement the
+// methods with the right signatures and take care to fulfil the contracts outlines above).
+//  Functions do not influence each other, so the drivers only ever look at one of them. This way,
+// runOnModule can analyse them in parallel. Everything that is shared between the threads (i.e. the
+// module) is only read.
 // Note that a lot of this code is duplicated in executeFixpointAlgorithmWidening in
 // fixpoint_widening.cpp, so if you fix any bugs in here, they probably should be fixed there as
 // well.
 //  Tip: Look at a diff of fixpoint.cpp and fixpoint_widening.cpp with a visual diff tool (I
 // recommend Meld.)
+//  Weak topological orderings are not supported here, as there is no widening. Instead, we just use
+// the reverse post-order worklist for Scheduling::WTO.
+//  After iterations_max basic blocks (see iterationBudget), values that still change are set to top
+// instead. This always terminates quickly, and keeps the result sound.
+//  If prune_states is set, the states of the blocks only keep the values that are still needed (see
+// Liveness), which makes them smaller and cheaper to merge for long functions.
 template <typename AbstractState>
-void executeFixpointAlgorithm(llvm::Module const& M) {
-    constexpr int iterations_max = 1000;
-
-    // A node in the control flow graph, i.e. a basic block. Here, we need a bit of additional data
-    // per node to execute the fixpoint algorithm.
-    struct Node {
-        int id;
-        llvm::BasicBlock const* bb;
-        AbstractState state;
-        bool update_scheduled = false; // Whether the node is already in the worklist
-
-        // If this is set, the algorithm will add the initial values from the parameters of the
-        // function to the incoming values, which is the correct thing to do for initial basic
-        // blocks.
-        llvm::Function const* func_entry = nullptr;
-    };
-
-    std::vector<Node> nodes;
-    std::unordered_map<llvm::BasicBlock const*, int> nodeIdMap; // Maps basic blocks to the ids of their corresponding nodes
-    std::vector<int> worklist; // Contains the ids of nodes that need to be processed
+void executeFixpointAlgorithm(llvm::Function const& f, Scheduling::Type scheduling, int iterations_max, bool prune_states) {
+    Scheduling::Type worklist_scheduling = scheduling == Scheduling::WTO ? Scheduling::RPO : scheduling;
 
-    // TODO: Check what this does for release clang, probably write out a warning
-    dbgs(1) << "Initialising fixpoint algorithm, collecting basic blocks\n";
+    // The nodes of the control flow graph, i.e. the basic blocks, are identified by their ids in
+    // cfg. Here, we need a bit of additional data per node to execute the fixpoint algorithm. Each
+    // part of it is kept in its own array, indexed by the id, so that the iteration only touches
+    // what it needs.
+    ControlFlowGraph<llvm::BasicBlock const> cfg {f};
+    std::vector<AbstractState> states (cfg.size()); // The states leaving the nodes, initialised to bottom
+    std::vector<char> update_scheduled (cfg.size()); // Whether the node is already in the worklist
+    std::vector<int> visits (cfg.size()); // Number of times the node was processed, for the statistics
 
-    for (llvm::Function const& f: M.functions()) {
-        // Check for external (i.e. declared but not defined) functions
-        if (f.empty()) {
-            dbgs(1) << "  Function " << f.getName() << " is external, skipping...";
-            continue;
-        }
+    Worklist worklist {worklist_scheduling}; // Contains the ids of nodes that need to be processed
 
-        // Register basic blocks
-        for (llvm::BasicBlock const& bb: f) {
-            dbgs(1) << "  Found basic block " << bb.getName() << '\n';
+    // Number the values of the function, so that the states can use flat arrays
+    ValueNumbering numbering {f};
 
-            Node node;
-            node.id = nodes.size(); // Assign new id
-            node.bb = &bb;
-            // node.state is default initialised (to bottom)
+    // Only computed if we use it
+    std::unique_ptr<Liveness> liveness;
+    if (prune_states) liveness.reset(new Liveness {f, numbering});
 
-            nodeIdMap[node.bb] = node.id;
-            nodes.push_back(node);
+    // TODO: Check what this does for release clang, probably write out a warning
+    DBGS(1) << "\nAnalysing function " << f.getName() << ", collecting basic blocks\n";
+
+    if (debugEnabled(1)) {
+        for (int id = 0; id < cfg.size(); ++id) {
+            dbgs(1) << "  Found basic block " << cfg.block(id)->getName() << '\n';
         }
+    }
 
-        // Push the initial block into the worklist
-        int entry_id = nodeIdMap.at(&f.getEntryBlock());
-        worklist.push_back(entry_id);
-        nodes[entry_id].update_scheduled = true;
-        nodes[entry_id].func_entry = &f;
+    // The priorities of the worklist are given by the reverse post-order. Blocks that cannot be
+    // reached are not part of it, they come last.
+    int priority = 0;
+    for (llvm::BasicBlock const * bb: llvm::ReversePostOrderTraversal<llvm::Function const *> {&f}) {
+        worklist.setPriority(cfg.id(*bb), priority++);
     }
 
-    dbgs(1) << "\nWorklist initialised with " << worklist.size() << (worklist.size() != 1 ? " entries" : " entry")
+    // Push the initial block into the worklist. For it, the algorithm will add the initial values
+    // from the parameters of the function to the incoming values.
+    int entry_id = cfg.id(f.getEntryBlock());
+    worklist.push(entry_id);
+    update_scheduled[entry_id] = true;
+
+    DBGS(1) << "\nWorklist initialised with " << worklist.size() << (worklist.size() != 1 ? " entries" : " entry")
             << ". Starting fixpoint iteration...\n";
 
-    for (int iter = 0; !worklist.empty() and iter < iterations_max; ++iter) {
-        Node& node = nodes[worklist.back()];
-        worklist.pop_back();
-        node.update_scheduled = false;
+    int iter = 0;
+    for (; !worklist.empty(); ++iter) {
+        if (iter == iterations_max) {
+            DBGS(0) << "Iteration exceeded its budget of " << iterations_max << " basic blocks, widening changing values to top.\n";
+            counters.budget_exceeded = true;
+        }
+
+        int id = worklist.pop();
+        llvm::BasicBlock const& bb = *cfg.block(id);
+        update_scheduled[id] = false;
+        ++visits[id];
 
-        dbgs(1) << "\nIteration " << iter << ", considering basic block " << node.bb->getName() << '\n';
+        DBGS(1) << "\nIteration " << iter << ", considering basic block " << bb.getName() << '\n';
 
         AbstractState state_new; // Set to bottom
 
-        if (node.func_entry) {
-            dbgs(1) << "  Merging function parameters, is entry block\n";
+        if (id == entry_id) {
+            DBGS(1) << "  Merging function parameters, is entry block\n";
 
-            AbstractState state_entry {*node.func_entry};
+            AbstractState state_entry {f, numbering};
+            ProfileTimer timer {counters.merge_seconds};
             state_new.merge(Merge_op::UPPER_BOUND, state_entry);
         }
 
-        dbgs(1) << "  Merge of " << llvm::pred_size(node.bb)
-                << (llvm::pred_size(node.bb) != 1 ? " predecessors.\n" : " predecessor.\n");
+        DBGS(1) << "  Merge of " << cfg.predecessors(id).size()
+                << (cfg.predecessors(id).size() != 1 ? " predecessors.\n" : " predecessor.\n");
 
         // Collect the predecessors
         std::vector<AbstractState> predecessors;
-        for (llvm::BasicBlock const* bb: llvm::predecessors(node.bb)) {
-            dbgs(3) << "    Merging basic block " << bb->getName() << '\n';
+        for (int pred: cfg.predecessors(id)) {
+            DBGS(3) << "    Merging basic block " << cfg.block(pred)->getName() << '\n';
 
-            AbstractState state_branched {nodes[nodeIdMap[bb]].state};
-            state_branched.branch(*bb, *node.bb);
-            state_new.merge(Merge_op::UPPER_BOUND, state_branched);
-            predecessors.push_back(state_branched);
+            AbstractState state_branched {states[pred]};
+            {
+                ProfileTimer timer {counters.branch_seconds};
+                state_branched.branch(*cfg.block(pred), bb);
+            }
+            {
+                ProfileTimer timer {counters.merge_seconds};
+                state_new.merge(Merge_op::UPPER_BOUND, state_branched);
+            }
+            predecessors.push_back(std::move(state_branched));
         }
 
-        dbgs(2) << "  Relevant incoming state is:\n"; state_new.printIncoming(*node.bb, dbgs(2), 4);
+        if (debugEnabled(2)) {
+            dbgs(2) << "  Relevant incoming state is:\n"; state_new.printIncoming(bb, dbgs(2), 4);
+        }
 
         // Apply the basic block
-        dbgs(3) << "  Applying basic block\n";
-        state_new.apply(*node.bb, predecessors);
+        DBGS(3) << "  Applying basic block\n";
+        {
+            ProfileTimer timer {counters.apply_seconds};
+            state_new.apply(bb, predecessors);
+        }
+
+        // Drop the values that are not needed anymore, see Liveness
+        if (liveness) state_new.keepOnly(liveness->keptValues(id));
 
         // Merge the state back into the node
-        dbgs(3) << "  Merging with stored state\n";
-        bool changed = node.state.merge(Merge_op::UPPER_BOUND, state_new);
+        DBGS(3) << "  Merging with stored state\n";
+        std::vector<int> changes; // Only collected for the debug output
+        Merge_op::Type op = iter < iterations_max ? Merge_op::UPPER_BOUND : Merge_op::WIDEN_TOP;
+        bool changed;
+        {
+            ProfileTimer timer {counters.merge_seconds};
+            changed = states[id].merge(op, state_new, debugEnabled(2) ? &changes : nullptr);
+        }
+        if (changed) ++counters.changed_merges;
 
-        dbgs(2) << "  Outgoing state is:\n"; state_new.printOutgoing(*node.bb, dbgs(2), 4);
+        if (debugEnabled(2)) {
+            dbgs(2) << "  Outgoing state is:\n"; state_new.printOutgoing(bb, dbgs(2), 4);
+        }
 
         // No changes, so no need to do anything else
         if (not changed) continue;
 
-        dbgs(2) << "  State changed, notifying " << llvm::succ_size(node.bb)
-                << (llvm::succ_size(node.bb) != 1 ? " successors\n" : " successor\n");
+        if (debugEnabled(2)) {
+            dbgs(2) << "  Changed values:";
+            for (int value: changes) dbgs(2) << " %" << numbering.value(value)->getName();
+            dbgs(2) << '\n';
+        }
+
+        DBGS(2) << "  State changed, notifying " << cfg.successors(id).size()
+                << (cfg.successors(id).size() != 1 ? " successors\n" : " successor\n");
 
         // Something changed and we will need to update the successors
-        for (llvm::BasicBlock const* succ_bb: llvm::successors(node.bb)) {
-            Node& succ = nodes[nodeIdMap[succ_bb]];
-            if (not succ.update_scheduled) {
-                worklist.push_back(succ.id);
-                succ.update_scheduled = true;
+        for (int succ: cfg.successors(id)) {
+            if (not update_scheduled[succ]) {
+                worklist.push(succ);
+                update_scheduled[succ] = true;
 
-                dbgs(3) << "    Adding " << succ_bb->getName() << " to worklist\n";
+                DBGS(3) << "    Adding " << cfg.block(succ)->getName() << " to worklist\n";
             }
         }
     }
 
-    if (!worklist.empty()) {
-        dbgs(0) << "Iteration terminated due to exceeding loop count.\n";
-    }
+    counters.iterations += iter;
+    countNodes(cfg, states, visits);
+    DBGS(1) << "\nFixpoint iteration finished after " << iter << " iterations\n";
     
     // Output the final result
-    dbgs(0) << "\nFinal result:\n";
-    for (Node const& i: nodes) {
-        dbgs(0) << i.bb->getName() << ":\n";
-        i.state.printOutgoing(*i.bb, dbgs(0), 2);
+    if (output_format == Output_format::TEXT) {
+        DBGS(0) << "\nFinal result:\n";
+        for (int id = 0; id < cfg.size(); ++id) {
+            DBGS(0) << cfg.block(id)->getName() << ":\n";
+            states[id].printOutgoing(*cfg.block(id), dbgs(0), 2);
+        }
+    } else if (output_format == Output_format::JSONL) {
+        // For each value, the state of the block defining it. (Arguments belong to the entry.)
+        std::vector<AbstractState const*> defining (numbering.size(), &states[entry_id]);
+        for (int id = 0; id < cfg.size(); ++id) {
+            for (llvm::Instruction const& inst: *cfg.block(id)) {
+                int value = numbering.lookup(inst);
+                if (value != -1) defining[value] = &states[id];
+            }
+        }
+
+        ValueNames names {f};
+        for (int id = 0; id < cfg.size(); ++id) {
+            states[id].printOutgoingJson(*cfg.block(id), *result_stream, defining, names);
+        }
     }
 }
 
+// Returns the number of basic blocks the fixpoint drivers process for f, before they give up on
+// precision. This grows with the size of the function, and blocks in loops count once more for each
+// loop they are part of, as those are visited repeatedly.
+static int iterationBudget(llvm::Function& f) {
+    llvm::LoopInfoBase<llvm::BasicBlock, llvm::Loop> loopInfoBase;
+    loopInfoBase.analyze(llvm::DominatorTree {f});
+
+    long weight = 0;
+    for (llvm::BasicBlock const& bb: f) weight += 1 + loopInfoBase.getLoopDepth(&bb);
+    return std::min<long>(iterations_base + iterations_per_block * weight, INT_MAX);
+}
+
 bool AbstractInterpretationPass::runOnModule(llvm::Module& M) {
     using AbstractState = AbstractStateValueSet<SimpleInterval>;
 
-    // Use either the standard fixpoint algorithm or the version with widening
-    //executeFixpointAlgorithm        <AbstractState>(M);
-      executeFixpointAlgorithmWidening<AbstractState>(M);
+    std::vector<llvm::Function*> functions;
+    for (llvm::Function& f: M.functions()) {
+        // Check for external (i.e. declared but not defined) functions
+        if (f.empty()) {
+            DBGS(1) << "Function " << f.getName() << " is external, skipping...\n";
+            continue;
+        }
+        if (not only_functions.empty()
+            and std::find(only_functions.begin(), only_functions.end(), f.getName()) == only_functions.end()) {
+            continue;
+        }
+        functions.push_back(&f);
+    }
+
+    int threads = thread_count ? thread_count : std::max<int>(std::thread::hardware_concurrency(), 1);
+
+    // The order in which the functions are started. When running in parallel, we start with the
+    // largest ones, so that they do not end up running on their own at the end.
+    std::vector<int> order (functions.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (threads > 1) {
+        std::vector<int> sizes;
+        for (llvm::Function* f: functions) {
+            int size = 0;
+            for (llvm::BasicBlock const& bb: *f) size += bb.size();
+            sizes.push_back(size);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+
+        // This constant is created lazily the first time it is requested, which the threads must
+        // not race for. Afterwards, they only read the module.
+        llvm::ConstantInt::getFalse(M.getContext());
+    }
+
+    // ScalarEvolution creates constants, so unlike everything else, this cannot run in parallel
+    std::vector<std::unique_ptr<InductionRanges>> inductions (functions.size());
+    if (use_scev) {
+        llvm::TargetLibraryInfoImpl libraryInfoImpl {llvm::Triple {M.getTargetTriple()}};
+        llvm::TargetLibraryInfo libraryInfo {libraryInfoImpl};
+        for (int i = 0; i < (int)functions.size(); ++i) {
+            inductions[i].reset(new InductionRanges {*functions[i], libraryInfo});
+        }
+    }
+
+    // The output of each function, if we are running in parallel. Otherwise, it is written directly.
+    std::vector<std::string> outputs (functions.size());
+    std::vector<std::string> stats (functions.size()); // One JSON object for each function
+    std::vector<Counters> function_counters (functions.size());
+    profiling = not stats_file.empty();
+
+    // The JSONL results go through a buffered stream. It is flushed after each function, so that the
+    // results stay in order with the debug output. When running in parallel, they are collected
+    // like the debug output.
+    std::vector<std::string> results (threads > 1 ? functions.size() : 0);
+    std::ofstream results_file;
+    std::unique_ptr<llvm::raw_ostream> results_out;
+    if (output_format == Output_format::JSONL) {
+        if (output_file.empty()) {
+            results_out.reset(new llvm::raw_fd_ostream {2, false});
+        } else {
+            results_file.open(output_file);
+            results_out.reset(new llvm::raw_os_ostream {results_file});
+        }
+    }
+
+    parallelFor(functions.size(), threads, [&](int i) {
+        llvm::Function& f = *functions[order[i]];
+
+        std::unique_ptr<llvm::raw_string_ostream> output;
+        if (threads > 1) {
+            output.reset(new llvm::raw_string_ostream {outputs[order[i]]});
+            debug_stream = output.get();
+        }
+
+        std::unique_ptr<llvm::raw_string_ostream> result_buffer;
+        if (threads > 1 and results_out) {
+            result_buffer.reset(new llvm::raw_string_ostream {results[order[i]]});
+            result_stream = result_buffer.get();
+        } else {
+            result_stream = results_out.get();
+        }
+
+        counters = Counters {};
+        SimpleInterval::cacheCounters() = {};
+        auto time_start = std::chrono::steady_clock::now();
+
+        induction_ranges = inductions[order[i]].get();
+
+        // Use either the standard fixpoint algorithm, the version with widening, or the sparse one
+        switch (fixpoint_algorithm) {
+        case Fixpoint_algorithm::SIMPLE:   executeFixpointAlgorithm        <AbstractState> (f, scheduling, iterationBudget(f), prune_states); break;
+        case Fixpoint_algorithm::WIDENING: executeFixpointAlgorithmWidening<AbstractState> (f, scheduling, iterationBudget(f), prune_states, narrowing_rounds, use_thresholds); break;
+        case Fixpoint_algorithm::SPARSE:   executeFixpointAlgorithmSparse  <SimpleInterval>(f, iterationBudget(f), use_thresholds); break;
+        default: assert(false /* invalid value for fixpoint_algorithm */);
+        }
+
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - time_start;
+        debug_stream = nullptr;
+        result_stream = nullptr;
+        induction_ranges = nullptr;
+        if (threads == 1 and results_out) results_out->flush();
+        counters.memo_hits   = SimpleInterval::cacheCounters().hits;
+        counters.memo_misses = SimpleInterval::cacheCounters().misses;
+        function_counters[order[i]] = counters;
+
+        if (not stats_file.empty()) {
+            int instructions = 0;
+            for (llvm::BasicBlock const& bb: f) instructions += bb.size();
+
+            llvm::raw_string_ostream out {stats[order[i]]};
+            out << "{\"function\": "; printJsonString(out, f.getName());
+            out << ", \"blocks\": " << f.size() << ", \"instructions\": " << instructions
+                << ", \"iterations\": " << counters.iterations
+                << ", \"budget_exceeded\": " << (counters.budget_exceeded ? "true" : "false")
+                << ", \"transfer_calls\": " << counters.transfer_calls
+                << ", \"memo_hits\": " << counters.memo_hits << ", \"memo_misses\": " << counters.memo_misses
+                << ", \"max_block_visits\": " << counters.max_block_visits << ", \"hottest_block\": ";
+            printJsonString(out, counters.hottest_block);
+            out << ", \"widen_merges\": " << counters.widen_merges << ", \"narrow_merges\": " << counters.narrow_merges
+                << ", \"changed_merges\": " << counters.changed_merges
+                << ", \"max_state_values\": " << counters.max_state_values
+                << ", \"total_state_values\": " << counters.total_state_values
+                << ", \"apply_seconds\": " << llvm::format("%.6f", counters.apply_seconds)
+                << ", \"merge_seconds\": " << llvm::format("%.6f", counters.merge_seconds)
+                << ", \"branch_seconds\": " << llvm::format("%.6f", counters.branch_seconds)
+                << ", \"seconds\": " << llvm::format("%.6f", time.count()) << "}\n";
+        }
+    });
+
+    // Now output everything in the order of the module, so that the result does not depend on the
+    // scheduling of the threads.
+    for (std::string const& i: outputs) {
+        llvm::errs() << i;
+    }
+    if (results_out) {
+        for (std::string const& i: results) *results_out << i;
+        results_out->flush();
+        if (not output_file.empty() and not results_file.flush()) {
+            llvm::errs() << "Error: could not write results to " << output_file << '\n';
+        }
+    }
+
+    // The totals for -stats. (These only count if LLVM was built with assertions or LLVM_ENABLE_STATS.)
+    for (Counters const& i: function_counters) {
+        ++NumFunctions;
+        NumBudgetExceeded += i.budget_exceeded;
+        NumIterations     += i.iterations;
+        NumTransferCalls  += i.transfer_calls;
+        NumWidenMerges    += i.widen_merges;
+        NumNarrowMerges   += i.narrow_merges;
+        NumChangedMerges  += i.changed_merges;
+    }
+
+    if (not stats_file.empty()) {
+        std::ofstream out {stats_file};
+        for (std::string const& i: stats) out << i;
+        if (not out) {
+            llvm::errs() << "Error: could not write statistics to " << stats_file << '\n';
+        }
+    }
 
     // We never change anything
     return false;
@@ -0,0 +1,397 @@
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Analysis/LoopInfo.h"
+
+#include "global.h"
+#include "induction_ranges.h"
+#include "result_output.h"
+#include "statistics.h"
+#include "widening_thresholds.h"
+#include "value_set.h"
+#include "worklist.h"
+
+namespace pcpo {
+
+// Run a sparse fixpoint algorithm. Instead of computing a state for each basic block, this keeps a
+// single abstract value for each SSA value of a function, and propagates changes along the def-use
+// chains. So if a value changes, only the instructions using it are evaluated again, instead of
+// whole basic blocks. This is what you want for long basic blocks.
+//  Unlike the other two algorithms, this is not generic over the AbstractState, it directly uses an
+// AbstractDomain (see AbstractDomainDummy in value_set.h), whose interpret serves as transfer
+// function. Branching is handled in two ways: Edges are only followed if the condition of the
+// branch permits it (so unreachable code stays bottom), and when an operand is used in a block that
+// is dominated by a branch comparing it, it is restricted using refineBranch. The same happens for
+// the incoming values of phi nodes. However, this is less precise than the other algorithms, as
+// values are only refined where they are used, and not everywhere a branch dominates.
+//  The instructions are processed in the reverse post-order of their blocks, so that an instruction
+// is usually evaluated after its operands, and only again once something changes along a back edge.
+//  Widening is done at the phi nodes of loop headers, followed by a round of narrowing, similar to
+// what executeFixpointAlgorithmWidening does, including the thresholds if use_thresholds is set.
+// Narrowing starts from the phi nodes that were widened, as nothing else can become more precise.
+//  The budget iterations_max counts basic blocks, as for the other algorithms (see iterationBudget).
+// As this evaluates single instructions instead, it is scaled by the average size of a block. Once
+// it is used up, values that still change are set to top, and narrowing just stops.
+template <typename AbstractDomain>
+void executeFixpointAlgorithmSparse(llvm::Function& f, int iterations_max, bool use_thresholds) {
+    constexpr int widen_after = 2; // Number of changes of a loop phi after which we switch to widening.
+
+    // A branch that dominates a basic block. Within that block, the operands of cmp are known to
+    // fulfil pred.
+    struct Condition {
+        llvm::ICmpInst const* cmp;
+        llvm::CmpInst::Predicate pred;
+    };
+
+    int iter = 0;
+    int evaluations = 0; // Number of calls to the transfer functions
+
+    long instruction_count = 0;
+    for (llvm::BasicBlock const& bb: f) instruction_count += bb.size();
+    int budget = std::min<long>((long)iterations_max * instruction_count / f.size(), INT_MAX);
+
+    DBGS(1) << "\nAnalysing function " << f.getName() << " using the sparse fixpoint algorithm\n";
+
+    ValueNumbering numbering {f};
+    std::vector<AbstractDomain> values (numbering.size()); // Initialised to bottom
+    std::vector<int> change_count (numbering.size());
+    for (llvm::Argument const& arg: f.args()) {
+        values[numbering.lookup(arg)] = AbstractDomain {true};
+    }
+
+    // We have to re-evaluate an instruction if one of its operands changes, but also if one of
+    // the values it is compared against in a dominating branch changes. The latter are stored
+    // here, indexed by the number of the compared value.
+    std::vector<std::vector<llvm::Instruction const*>> extra_users (numbering.size());
+
+    // The constants widening stops at, see executeFixpointAlgorithmWidening
+    std::unique_ptr<WideningThresholds> thresholds;
+    if (use_thresholds) thresholds.reset(new WideningThresholds {f});
+    widening_thresholds = thresholds.get();
+
+    llvm::DominatorTree domTree {f};
+    llvm::LoopInfoBase<llvm::BasicBlock, llvm::Loop> loopInfoBase;
+    loopInfoBase.analyze(domTree);
+
+    // Collect the branches dominating each basic block. We only look at edges towards blocks
+    // with a single predecessor, as only those restrict all the values in the blocks they
+    // dominate.
+    llvm::DenseMap<llvm::BasicBlock const*, std::vector<Condition>> conditions;
+    for (llvm::BasicBlock const& bb: f) {
+        std::vector<Condition>& conds = conditions[&bb];
+        for (llvm::DomTreeNode* node = domTree.getNode(&bb); node; node = node->getIDom()) {
+            llvm::BasicBlock const* dom = node->getBlock();
+            llvm::BasicBlock const* pred = dom->getSinglePredecessor();
+            if (not pred) continue;
+
+            llvm::BranchInst const* branch = llvm::dyn_cast<llvm::BranchInst>(pred->getTerminator());
+            if (not branch or branch->isUnconditional()) continue;
+            llvm::ICmpInst const* cmp = llvm::dyn_cast<llvm::ICmpInst>(branch->getCondition());
+            if (not cmp or branch->getSuccessor(0) == branch->getSuccessor(1)) continue;
+
+            conds.push_back({cmp, branch->getSuccessor(0) == dom ? cmp->getPredicate() : cmp->getInversePredicate()});
+        }
+    }
+
+    // Returns the value of v, and the value of v restricted by all the given conditions. Whoever
+    // uses the latter needs to be registered using registerConditions.
+    auto valueOf = [&](llvm::Value const& v) {
+        if (llvm::Constant const* c = llvm::dyn_cast<llvm::Constant>(&v)) return AbstractDomain {*c};
+        int id = numbering.lookup(v);
+        return id != -1 ? values[id] : AbstractDomain {true};
+    };
+    auto refinedValueOf = [&](llvm::Value const& v, std::vector<Condition> const& conds) {
+        AbstractDomain result = valueOf(v);
+        for (Condition cond: conds) {
+            llvm::Value const& lhs = *cond.cmp->getOperand(0);
+            llvm::Value const& rhs = *cond.cmp->getOperand(1);
+            if (&lhs == &v) {
+                result = AbstractDomain::refineBranch(cond.pred, lhs, rhs, result, valueOf(rhs));
+            } else if (&rhs == &v) {
+                result = AbstractDomain::refineBranch(
+                    llvm::CmpInst::getSwappedPredicate(cond.pred), rhs, lhs, result, valueOf(lhs)
+                );
+            }
+        }
+        return result;
+    };
+    auto registerConditions = [&](llvm::Instruction const& user, llvm::Value const& v, std::vector<Condition> const& conds) {
+        for (Condition cond: conds) {
+            llvm::Value const* lhs = cond.cmp->getOperand(0);
+            llvm::Value const* rhs = cond.cmp->getOperand(1);
+            llvm::Value const* other = lhs == &v ? rhs : rhs == &v ? lhs : nullptr;
+            if (other and numbering.lookup(*other) != -1) {
+                extra_users[numbering.lookup(*other)].push_back(&user);
+            }
+        }
+    };
+
+    // The conditions that hold for an incoming value of a phi node, when coming from pred.
+    auto edgeConditions = [&](llvm::BasicBlock const* pred, llvm::BasicBlock const* succ) {
+        std::vector<Condition> conds = conditions[pred];
+        llvm::BranchInst const* branch = llvm::dyn_cast<llvm::BranchInst>(pred->getTerminator());
+        if (branch and branch->isConditional() and branch->getSuccessor(0) != branch->getSuccessor(1)) {
+            if (llvm::ICmpInst const* cmp = llvm::dyn_cast<llvm::ICmpInst>(branch->getCondition())) {
+                conds.push_back({cmp, branch->getSuccessor(0) == succ ? cmp->getPredicate() : cmp->getInversePredicate()});
+            }
+        }
+        return conds;
+    };
+
+    // These are needed every time a phi node is evaluated, so they are collected once for all edges
+    // towards blocks with phi nodes.
+    llvm::DenseMap<std::pair<llvm::BasicBlock const*, llvm::BasicBlock const*>, std::vector<Condition>> edge_conditions;
+    for (llvm::BasicBlock const& bb: f) {
+        if (not llvm::isa<llvm::PHINode>(bb.front())) continue;
+        for (llvm::BasicBlock const* pred: llvm::predecessors(&bb)) {
+            if (not edge_conditions.count({pred, &bb})) edge_conditions[{pred, &bb}] = edgeConditions(pred, &bb);
+        }
+    }
+
+    for (llvm::BasicBlock const& bb: f) {
+        for (llvm::Instruction const& inst: bb) {
+            if (llvm::PHINode const* phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+                for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+                    registerConditions(inst, *phi->getIncomingValue(i), edge_conditions[{phi->getIncomingBlock(i), &bb}]);
+                }
+            } else {
+                for (llvm::Value const* v: inst.operand_values()) {
+                    registerConditions(inst, *v, conditions[&bb]);
+                }
+            }
+        }
+    }
+
+    // The worklist contains the positions of the instructions in the reverse post-order, which also
+    // serve as their priorities. Blocks that cannot be reached are not part of it, but those never
+    // become executable anyway.
+    std::vector<llvm::Instruction const*> instructions;
+    llvm::DenseMap<llvm::Instruction const*, int> positions;
+    for (llvm::BasicBlock const* bb: llvm::ReversePostOrderTraversal<llvm::Function const*> {&f}) {
+        for (llvm::Instruction const& inst: *bb) {
+            positions[&inst] = instructions.size();
+            instructions.push_back(&inst);
+        }
+    }
+    Worklist worklist {Scheduling::RPO};
+    for (int i = 0; i < (int)instructions.size(); ++i) worklist.setPriority(i, i);
+    std::vector<char> scheduled (instructions.size()); // Whether the instruction is in the worklist
+
+    llvm::SmallPtrSet<llvm::BasicBlock const*, 16> executable_blocks;
+    llvm::DenseMap<std::pair<llvm::BasicBlock const*, llvm::BasicBlock const*>, bool> executable_edges;
+    std::vector<llvm::Instruction const*> widened; // The phi nodes that were widened, to start narrowing
+    std::vector<char> was_widened (numbering.size());
+    bool phase_narrowing = false;
+    bool narrowing_stopped = false;
+
+    auto schedule = [&](llvm::Instruction const& inst) {
+        if (not executable_blocks.count(inst.getParent())) return;
+        int position = positions.lookup(&inst);
+        if (scheduled[position]) return;
+        worklist.push(position);
+        scheduled[position] = true;
+    };
+    // Schedules everything that needs to be evaluated again when the value of inst changes
+    auto notify = [&](llvm::Instruction const& inst, int id) {
+        for (llvm::User const* user: inst.users()) {
+            if (llvm::Instruction const* user_inst = llvm::dyn_cast<llvm::Instruction>(user)) {
+                schedule(*user_inst);
+            }
+        }
+        for (llvm::Instruction const* user: extra_users[id]) schedule(*user);
+    };
+    auto markEdge = [&](llvm::BasicBlock const* from, llvm::BasicBlock const* to) {
+        if (executable_edges[{from, to}]) return;
+        executable_edges[{from, to}] = true;
+
+        DBGS(3) << "    Edge from " << (from ? from->getName() : "<entry>") << " towards " << to->getName()
+                << " is executable\n";
+
+        if (executable_blocks.insert(to).second) {
+            // The block was not reachable before, so we need to look at everything
+            for (llvm::Instruction const& inst: *to) schedule(inst);
+        } else {
+            // Only the phi nodes have a new incoming value
+            for (llvm::PHINode const& phi: to->phis()) schedule(phi);
+        }
+    };
+
+    markEdge(nullptr, &f.getEntryBlock());
+
+    std::vector<AbstractDomain> operands; // Reused for all instructions, so it is not allocated every time
+
+    while (true) {
+        if (worklist.empty()) {
+            if (phase_narrowing) break;
+
+            // We have reached a fixpoint using widening. Now do another round using narrowing,
+            // starting at the widened phi nodes. Their users are evaluated again as well, as they
+            // may be refined by the conditions of branches comparing the phi nodes.
+            phase_narrowing = true;
+            DBGS(1) << "  Starting narrowing in iteration " << iter << " at " << widened.size() << " phi nodes\n";
+            for (llvm::Instruction const* phi: widened) {
+                schedule(*phi);
+                notify(*phi, numbering.lookup(*phi));
+            }
+            continue;
+        }
+        bool out_of_budget = iter >= budget;
+        if (out_of_budget and phase_narrowing) {
+            narrowing_stopped = true;
+            break;
+        }
+        if (iter == budget) {
+            DBGS(0) << "Iteration exceeded its budget of " << iterations_max << " basic blocks, widening changing values to top.\n";
+            counters.budget_exceeded = true;
+        }
+        ++iter;
+
+        int position = worklist.pop();
+        scheduled[position] = false;
+        llvm::Instruction const& inst = *instructions[position];
+        llvm::BasicBlock const* bb = inst.getParent();
+
+        if (inst.isTerminator()) {
+            // Figure out which of the outgoing edges can be taken
+            llvm::BranchInst const* branch = llvm::dyn_cast<llvm::BranchInst>(&inst);
+            if (branch and branch->isConditional()) {
+                AbstractDomain cond = valueOf(*branch->getCondition());
+                AbstractDomain can_be_true  = AbstractDomain::refineBranch(
+                    llvm::CmpInst::ICMP_NE, *branch->getCondition(), *branch->getCondition(),
+                    cond, AbstractDomain {*llvm::ConstantInt::getFalse(inst.getContext())}
+                );
+                AbstractDomain can_be_false = AbstractDomain::refineBranch(
+                    llvm::CmpInst::ICMP_EQ, *branch->getCondition(), *branch->getCondition(),
+                    cond, AbstractDomain {*llvm::ConstantInt::getFalse(inst.getContext())}
+                );
+                if (not (can_be_true  == AbstractDomain {})) markEdge(bb, branch->getSuccessor(0));
+                if (not (can_be_false == AbstractDomain {})) markEdge(bb, branch->getSuccessor(1));
+            } else {
+                for (llvm::BasicBlock const* succ: llvm::successors(bb)) markEdge(bb, succ);
+            }
+            continue;
+        }
+
+        int id = numbering.lookup(inst);
+        if (id == -1 or inst.use_empty()) continue;
+
+        AbstractDomain inst_result;
+        bool loop_phi = false;
+
+        if (llvm::PHINode const* phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+            for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+                llvm::BasicBlock const* pred = phi->getIncomingBlock(i);
+                if (not executable_edges.lookup({pred, bb})) continue;
+
+                AbstractDomain pred_value = refinedValueOf(*phi->getIncomingValue(i), edge_conditions[{pred, bb}]);
+                inst_result = AbstractDomain::merge(Merge_op::UPPER_BOUND, inst_result, pred_value);
+            }
+            loop_phi = loopInfoBase.isLoopHeader(bb);
+
+            // An induction variable, we already know all values it takes, so there is nothing to widen
+            llvm::ConstantRange const* range = induction_ranges ? induction_ranges->lookup(*phi) : nullptr;
+            if (range and not (inst_result == AbstractDomain {})) {
+                inst_result = AbstractDomain {*range};
+                loop_phi = false;
+            }
+        } else {
+            std::vector<Condition> const& conds = conditions[bb];
+            operands.clear();
+            for (llvm::Value const* v: inst.operand_values()) {
+                operands.push_back(refinedValueOf(*v, conds));
+            }
+            inst_result = AbstractDomain::interpret(inst, operands);
+            ++evaluations;
+        }
+
+        if (loop_phi and phase_narrowing) {
+            inst_result = AbstractDomain::merge(Merge_op::NARROW, values[id], inst_result);
+        } else if (out_of_budget or (loop_phi and change_count[id] >= widen_after)) {
+            Merge_op::Type op = out_of_budget ? Merge_op::WIDEN_TOP : Merge_op::WIDEN;
+            inst_result = AbstractDomain::merge(op, values[id], inst_result);
+            if (loop_phi and not was_widened[id] and not (inst_result == values[id])) {
+                widened.push_back(&inst);
+                was_widened[id] = true;
+            }
+        } else if (not phase_narrowing) {
+            // Values can only grow during the first phase. (The result may be smaller due to
+            // refinements of operands which did not stabilise yet, so this is needed.)
+            inst_result = AbstractDomain::merge(Merge_op::UPPER_BOUND, values[id], inst_result);
+        }
+
+        if (inst_result == values[id]) continue;
+
+        DBGS(3).indent(2) << inst << " // " << inst_result << ", was " << values[id] << '\n';
+
+        values[id] = inst_result;
+        ++change_count[id];
+
+        // Notify everyone who is interested
+        notify(inst, id);
+    }
+
+    if (narrowing_stopped and not counters.budget_exceeded) {
+        DBGS(1) << "\nNarrowing stopped after exceeding the budget of " << iterations_max << " basic blocks\n";
+        counters.budget_exceeded = true;
+    }
+
+    // Output the final result. Each basic block lists the values it defines.
+    if (output_format == Output_format::TEXT) {
+        DBGS(0) << "\nFinal result:\n";
+        for (llvm::BasicBlock const& bb: f) {
+            DBGS(0) << bb.getName() << ":\n";
+            bool nothing = true;
+            if (&bb == &f.getEntryBlock()) {
+                for (llvm::Argument const& arg: f.args()) {
+                    DBGS(0).indent(2) << '%' << arg.getName() << " = " << values[numbering.lookup(arg)] << '\n';
+                    nothing = false;
+                }
+            }
+            for (llvm::Instruction const& inst: bb) {
+                if (inst.use_empty()) continue;
+                DBGS(0).indent(2) << '%' << inst.getName() << " = " << values[numbering.lookup(inst)] << '\n';
+                nothing = false;
+            }
+            if (nothing) {
+                DBGS(0).indent(2) << "<nothing>\n";
+            }
+        }
+    } else if (output_format == Output_format::JSONL) {
+        // There is only one value for each SSA value, so nothing is ever refined
+        ValueNames names {f};
+        for (llvm::BasicBlock const& bb: f) {
+            names.printBlockStart(*result_stream, bb);
+            bool first = true;
+            if (&bb == &f.getEntryBlock()) {
+                for (llvm::Argument const& arg: f.args()) {
+                    names.printValue(*result_stream, arg, values[numbering.lookup(arg)], first);
+                    first = false;
+                }
+            }
+            for (llvm::Instruction const& inst: bb) {
+                if (inst.use_empty()) continue;
+                names.printValue(*result_stream, inst, values[numbering.lookup(inst)], first);
+                first = false;
+            }
+            *result_stream << "}}\n";
+        }
+    }
+
+    widening_thresholds = nullptr;
+    counters.iterations += iter;
+    counters.transfer_calls += evaluations;
+
+    DBGS(1) << "\nSparse fixpoint iteration finished after " << iter << " iterations, with " << evaluations
+            << " calls to the transfer function\n";
+}
+
+} /* end of namespace pcpo */
@@ -1,160 +1,196 @@
 
-#include <unordered_map>
+#include <functional>
+#include <memory>
 #include <vector>
 
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/LoopInfo.h"
 
+#include "control_flow_graph.h"
 #include "global.h"
+#include "result_output.h"
 #include "value_set.h"
 #include "simple_interval.h"
+#include "statistics.h"
+#include "weak_topological_order.h"
+#include "widening_thresholds.h"
+#include "worklist.h"
 
 namespace pcpo {
 
-// Run the fixpoint algorithm using widening and narrowing. Note that a lot of code in here is
-// duplicated from executeFixpointAlgorithm. If you just want to understand the basic fixpoint
-// iteration, you should take a look at that instead.
+// Run the fixpoint algorithm using widening and narrowing on a single function. Note that a lot of
+// code in here is duplicated from executeFixpointAlgorithm. If you just want to understand the
+// basic fixpoint iteration, you should take a look at that instead.
 //  The interface for AbstractState is the same as for the simple fixpoint (documented in
 // AbstractStateDummy), except that is needs to support the merge operations WIDEN and NARROW, as
 // you can probably guess.
+//  The basic blocks are either processed using a LIFO worklist, or by following a weak topological
+// ordering of the function (see WeakTopologicalOrder), depending on scheduling. With the latter,
+// loops are stabilised from the inside out and we widen at the heads of the components, while the
+// former widens at the loop headers found by LoopInfo.
+//  If the widening phase has not stabilised after iterations_max basic blocks (see iterationBudget),
+// values that still change are set to top instead. Narrowing just stops once the budget is used up,
+// as its intermediate results are sound as well. prune_states works as in executeFixpointAlgorithm.
+//  Narrowing starts from the nodes that were widened, and only continues to the successors of nodes
+// it changed, as nothing else can become more precise. So for functions without loops, there is
+// nothing to do. Each node is narrowed at most narrowing_rounds times (0 means no limit).
+//  If use_thresholds is set, widening first stops at the constants of the function (see
+// WideningThresholds).
 //  Tip: Look at a diff of fixpoint.cpp and fixpoint_widening.cpp with a visual diff tool (I
 // recommend Meld.)
 template <typename AbstractState>
-void executeFixpointAlgorithmWidening(llvm::Module& M) {
-    constexpr int iterations_max = 1000;
+void executeFixpointAlgorithmWidening(
+    llvm::Function& f, Scheduling::Type scheduling, int iterations_max, bool prune_states, int narrowing_rounds,
+    bool use_thresholds
+) {
     constexpr int widen_after = 2; // Number of iteration after which we switch to widening.
-
-    // A node in the control flow graph, i.e. a basic block. Here, we need a bit of additional data
-    // per node to execute the fixpoint algorithm.
-    struct Node {
-        int id;
-        llvm::BasicBlock* bb;
-        AbstractState state;
-        bool update_scheduled = false; // Whether the node is already in the worklist
-
-        // If this is set, the algorithm will add the initial values from the parameters of the
-        // function to the incoming values, which is the correct thing to do for initial basic
-        // blocks.
-        llvm::Function* func_entry = nullptr;
-
-        bool should_widen = false; // Whether we want to widen at this node
-        int change_count = 0; // How often has node changed during iterations
-    };
-
-    std::vector<Node> nodes;
-    std::unordered_map<llvm::BasicBlock*, int> nodeIdMap; // Maps basic blocks to the ids of their corresponding nodes
-    std::vector<int> worklist; // Contains the ids of nodes that need to be processed
+    Scheduling::Type worklist_scheduling = scheduling == Scheduling::WTO ? Scheduling::LIFO : scheduling; // Unused for WTO
+
+    // The nodes of the control flow graph, i.e. the basic blocks, are identified by their ids in
+    // cfg. As in executeFixpointAlgorithm, the data we need per node is kept in separate arrays.
+    ControlFlowGraph<llvm::BasicBlock> cfg {f};
+    std::vector<AbstractState> states (cfg.size()); // The states leaving the nodes, initialised to bottom
+    std::vector<char> update_scheduled (cfg.size()); // Whether the node is already in the worklist
+    std::vector<int> visits (cfg.size()); // Number of times the node was processed, for the statistics
+    std::vector<char> should_widen (cfg.size()); // Whether we want to widen at this node
+    std::vector<int> change_count (cfg.size()); // How often has node changed during iterations
+    std::vector<char> narrow_pending (cfg.size()); // Whether narrowing needs to look at the node
+    std::vector<int> narrow_count (cfg.size()); // How often the node was narrowed
+
+    Worklist worklist {worklist_scheduling}; // Contains the ids of nodes that need to be processed
     bool phase_narrowing = false; // If this is set, we are in the narrowing phase of the fixpoint algorithm
 
-    dbgs(1) << "Initialising fixpoint algorithm, collecting basic blocks\n";
+    // Number the values of the function, so that the states can use flat arrays
+    ValueNumbering numbering {f};
 
-    // Push dummy element indicating the end of the widening phase of the fixpoint algorithm. As the
-    // worklist is processed in a LIFO order, this will be the last element coming out, indicating
-    // that the worklist is empty. Once that happens, we have obtained a valid solution (using
-    // widening) and can start to apply narrowing.
-    worklist.push_back(-1);
+    // Only computed if we use it
+    std::unique_ptr<Liveness> liveness;
+    if (prune_states) liveness.reset(new Liveness {f, numbering});
 
-    for (llvm::Function& f: M.functions()) {
-        // Check for external (i.e. declared but not defined) functions
-        if (f.empty()) {
-            dbgs(1) << "  Function " << f.getName() << " is external, skipping...";
-            continue;
+    DBGS(1) << "\nAnalysing function " << f.getName() << ", collecting basic blocks\n";
+
+    if (debugEnabled(1)) {
+        for (int id = 0; id < cfg.size(); ++id) {
+            dbgs(1) << "  Found basic block " << cfg.block(id)->getName() << '\n';
         }
+    }
 
-        // Register basic blocks
-        for (llvm::BasicBlock& bb: f) {
-            dbgs(1) << "  Found basic block " << bb.getName() << '\n';
+    // The constants widening stops at, for SimpleInterval::merge. This points to our local, so it is
+    // reset at the end.
+    std::unique_ptr<WideningThresholds> thresholds;
+    if (use_thresholds) thresholds.reset(new WideningThresholds {f});
+    widening_thresholds = thresholds.get();
+
+    // The priorities of the worklist are given by the reverse post-order. Blocks that cannot be
+    // reached are not part of it, they come last.
+    int priority = 0;
+    for (llvm::BasicBlock * bb: llvm::ReversePostOrderTraversal<llvm::Function *> {&f}) {
+        worklist.setPriority(cfg.id(*bb), priority++);
+    }
 
-            Node node;
-            node.id = nodes.size(); // Assign new id
-            node.bb = &bb;
-            // node.state is default initialised (to bottom)
+    // Only computed if we use it
+    std::unique_ptr<WeakTopologicalOrder<llvm::BasicBlock>> wto;
 
-            nodeIdMap[node.bb] = node.id;
-            nodes.push_back(node);
+    if (scheduling == Scheduling::WTO) {
+        // Every cycle goes through the head of a component, so widening there is enough.
+        wto.reset(new WeakTopologicalOrder<llvm::BasicBlock> {cfg});
+        if (debugEnabled(1)) {
+            dbgs(1) << "  Weak topological ordering is "; wto->print(dbgs(1)); dbgs(1) << '\n';
         }
-        
+
+        wto->forEachHead([&](int head) {
+            should_widen[head] = true;
+            DBGS(1) << "  Enabling widening for basic block " << cfg.block(head)->getName() << '\n';
+        });
+    } else {
         // Gather information about loops in the function. (We only want to widen a single node for
         // each loop, as that is enough to guarantee fast termination.)
         llvm::LoopInfoBase<llvm::BasicBlock, llvm::Loop> loopInfoBase;
         loopInfoBase.analyze(llvm::DominatorTree {f});
         for (llvm::Loop* loop: loopInfoBase) {
             // We want to widen only the conditions of the loops
-            nodes[nodeIdMap.at(loop->getHeader())].should_widen = true;
-            dbgs(1) << "  Enabling widening for basic block " << loop->getHeader()->getName() << '\n';
+            should_widen[cfg.id(*loop->getHeader())] = true;
+            DBGS(1) << "  Enabling widening for basic block " << loop->getHeader()->getName() << '\n';
         }
-
-        // Push the initial block into the worklist
-        int entry_id = nodeIdMap.at(&f.getEntryBlock());
-        worklist.push_back(entry_id);
-        nodes[entry_id].update_scheduled = true;
-        nodes[entry_id].func_entry = &f;
     }
 
-    dbgs(1) << "\nWorklist initialised with " << worklist.size() << (worklist.size() != 1 ? " entries" : " entry")
-            << ". Starting fixpoint iteration...\n";
+    // Push the initial block into the worklist. For it, the algorithm will add the initial values
+    // from the parameters of the function to the incoming values.
+    int entry_id = cfg.id(f.getEntryBlock());
+    worklist.push(entry_id);
+    update_scheduled[entry_id] = true;
 
-    for (int iter = 0; !worklist.empty() and iter < iterations_max; ++iter) {
-        
-        // Check whether we have reached the end of the widening phase
-        if (worklist.back() == -1) {
-            worklist.pop_back();
-            phase_narrowing = true;
-            dbgs(1) << "\nStarting narrowing in iteration " << iter << "\n";
-
-            // We need to consider all nodes once more.
-            for (Node const& i: nodes) {
-                worklist.push_back(i.id);
-            }
+    int iter = 0;
 
-            --iter;
-            continue;
-        }
+    // Compute the state of a node anew, using the states of its predecessors, and merge it into the
+    // stored one. Returns whether that changed anything.
+    auto update = [&](int id) {
+        llvm::BasicBlock const& bb = *cfg.block(id);
 
-        Node& node = nodes[worklist.back()];
-        worklist.pop_back();
-        node.update_scheduled = false;
+        if (iter == iterations_max and not phase_narrowing) {
+            DBGS(0) << "Iteration exceeded its budget of " << iterations_max << " basic blocks, widening changing values to top.\n";
+            counters.budget_exceeded = true;
+        }
 
-        dbgs(1) << "\nIteration " << iter << ", considering basic block " << node.bb->getName() << '\n';
+        DBGS(1) << "\nIteration " << iter << ", considering basic block " << bb.getName() << '\n';
+        ++visits[id];
 
         AbstractState state_new; // Set to bottom
 
-        if (node.func_entry) {
-            dbgs(1) << "  Merging function parameters, is entry block\n";
+        if (id == entry_id) {
+            DBGS(1) << "  Merging function parameters, is entry block\n";
 
-            AbstractState state_entry {*node.func_entry};
+            AbstractState state_entry {f, numbering};
+            ProfileTimer timer {counters.merge_seconds};
             state_new.merge(Merge_op::UPPER_BOUND, state_entry);
         }
 
-        dbgs(1) << "  Merge of " << llvm::pred_size(node.bb)
-                << (llvm::pred_size(node.bb) != 1 ? " predecessors.\n" : " predecessor.\n");
+        DBGS(1) << "  Merge of " << cfg.predecessors(id).size()
+                << (cfg.predecessors(id).size() != 1 ? " predecessors.\n" : " predecessor.\n");
 
         // Collect the predecessors
         std::vector<AbstractState> predecessors;
-        for (llvm::BasicBlock* bb: llvm::predecessors(node.bb)) {
-            dbgs(3) << "    Merging basic block " << bb->getName() << '\n';
+        for (int pred: cfg.predecessors(id)) {
+            DBGS(3) << "    Merging basic block " << cfg.block(pred)->getName() << '\n';
 
-            AbstractState state_branched {nodes[nodeIdMap[bb]].state};
-            state_branched.branch(*bb, *node.bb);
-            state_new.merge(Merge_op::UPPER_BOUND, state_branched);
-            predecessors.push_back(state_branched);
+            AbstractState state_branched {states[pred]};
+            {
+                ProfileTimer timer {counters.branch_seconds};
+                state_branched.branch(*cfg.block(pred), bb);
+            }
+            {
+                ProfileTimer timer {counters.merge_seconds};
+                state_new.merge(Merge_op::UPPER_BOUND, state_branched);
+            }
+            predecessors.push_back(std::move(state_branched));
         }
 
-        dbgs(2) << "  Relevant incoming state\n"; state_new.printIncoming(*node.bb, dbgs(2), 4);
+        if (debugEnabled(2)) {
+            dbgs(2) << "  Relevant incoming state\n"; state_new.printIncoming(bb, dbgs(2), 4);
+        }
 
         // Apply the basic block
-        dbgs(3) << "  Applying basic block\n";
-        state_new.apply(*node.bb, predecessors);
+        DBGS(3) << "  Applying basic block\n";
+        {
+            ProfileTimer timer {counters.apply_seconds};
+            state_new.apply(bb, predecessors);
+        }
+
+        // Drop the values that are not needed anymore, see Liveness
+        if (liveness) state_new.keepOnly(liveness->keptValues(id));
 
         // Merge the state back into the node
-        dbgs(3) << "  Merging with stored state\n";
+        DBGS(3) << "  Merging with stored state\n";
         
         // We need to figure out what operation to apply.
         Merge_op::Type op;
         if (not phase_narrowing) {
-            if (node.should_widen and node.change_count >= widen_after) {
+            if (iter >= iterations_max) {
+                op = Merge_op::WIDEN_TOP;
+            } else if (should_widen[id] and change_count[id] >= widen_after) {
                 op = Merge_op::WIDEN;
             } else {
                 op = Merge_op::UPPER_BOUND;
@@ -164,39 +200,174 @@ void executeFixpointAlgorithmWidening(llvm::Module& M) {
         }
 
         // Now do the actual operation
-        bool changed = node.state.merge(op, state_new);
+        std::vector<int> changes; // Only collected for the debug output
+        bool changed;
+        {
+            ProfileTimer timer {counters.merge_seconds};
+            changed = states[id].merge(op, state_new, debugEnabled(2) ? &changes : nullptr);
+        }
 
-        dbgs(2) << "  Outgoing state\n"; state_new.printOutgoing(*node.bb, dbgs(2), 4);
+        if (op == Merge_op::WIDEN)  ++counters.widen_merges;
+        if (op == Merge_op::NARROW) ++counters.narrow_merges;
+        if (changed) ++counters.changed_merges;
 
-        // No changes, so no need to do anything else
-        if (not changed) continue;
+        if (debugEnabled(2)) {
+            dbgs(2) << "  Outgoing state\n"; state_new.printOutgoing(bb, dbgs(2), 4);
+            if (changed) {
+                dbgs(2) << "  Changed values:";
+                for (int value: changes) dbgs(2) << " %" << numbering.value(value)->getName();
+                dbgs(2) << '\n';
+            }
+        }
 
-        ++node.change_count;
-        
-        dbgs(2) << "  State changed, notifying " << llvm::succ_size(node.bb)
-                << (llvm::succ_size(node.bb) != 1 ? " successors\n" : " successor\n");
+        if (changed) ++change_count[id];
 
-        // Something changed and we will need to update the successors
-        for (llvm::BasicBlock* succ_bb: llvm::successors(node.bb)) {
-            Node& succ = nodes[nodeIdMap[succ_bb]];
-            if (not succ.update_scheduled) {
-                worklist.push_back(succ.id);
-                succ.update_scheduled = true;
+        if (changed and (op == Merge_op::WIDEN or op == Merge_op::WIDEN_TOP)) narrow_pending[id] = true;
+        if (phase_narrowing) {
+            narrow_pending[id] = false;
+            ++narrow_count[id];
+            if (changed) {
+                for (int succ: cfg.successors(id)) narrow_pending[succ] = true;
+            }
+        }
+        return changed;
+    };
+
+    // Whether the node can be skipped during narrowing
+    auto skip_narrowing = [&](int id) {
+        return phase_narrowing
+            and (not narrow_pending[id] or (narrowing_rounds and narrow_count[id] >= narrowing_rounds));
+    };
+
+    // Only the narrowing phase may stop early, widening has to reach a fixpoint to be sound
+    bool narrowing_stopped = false;
+    auto out_of_budget = [&]() {
+        if (phase_narrowing and iter >= iterations_max) narrowing_stopped = true;
+        return narrowing_stopped;
+    };
+
+    if (scheduling == Scheduling::WTO) {
+        // Process the elements of a weak topological ordering. Components are repeated until the
+        // state of their head does not change anymore.
+        std::function<void(WeakTopologicalOrder<llvm::BasicBlock>::Element const&)> stabilise;
+        stabilise = [&](WeakTopologicalOrder<llvm::BasicBlock>::Element const& element) {
+            int id = element.id;
+            if (not element.is_component) {
+                if (not out_of_budget() and not skip_narrowing(id)) {
+                    update(id);
+                    ++iter;
+                }
+                return;
+            }
+
+            // Only count the changes during this stabilisation. Otherwise, an inner loop would start
+            // widening the values of the outer loop after it has been entered a few times, and
+            // narrowing cannot recover from that, as they just pass through the inner loop.
+            change_count[id] = 0;
+            
+            for (int round = 0; not out_of_budget(); ++round) {
+                bool changed = false;
+                if (not skip_narrowing(id)) {
+                    changed = update(id);
+                    ++iter;
+                }
+
+                // The body has to be processed at least once, even if the head did not change
+                if (round and not changed) break;
+
+                for (auto const& i: element.body) stabilise(i);
+            }
+        };
+
+        DBGS(1) << "\nStarting fixpoint iteration...\n";
+
+        for (auto const& i: wto->getElements()) stabilise(i);
+
+        // Now we have a valid solution (using widening), and can start to apply narrowing
+        phase_narrowing = true;
+        DBGS(1) << "\nStarting narrowing in iteration " << iter << "\n";
+        for (auto const& i: wto->getElements()) stabilise(i);
+    } else {
+        DBGS(1) << "\nWorklist initialised with " << worklist.size() << (worklist.size() != 1 ? " entries" : " entry")
+                << ". Starting fixpoint iteration...\n";
+
+        for (;; ++iter) {
+            
+            // Once the worklist is empty, we have obtained a valid solution (using widening) and
+            // can start to apply narrowing.
+            if (worklist.empty()) {
+                if (phase_narrowing) break;
+                phase_narrowing = true;
+                DBGS(1) << "\nStarting narrowing in iteration " << iter << "\n";
+
+                // Start with the nodes that were widened, the others are added once their
+                // predecessors change.
+                for (int id = 0; id < cfg.size(); ++id) {
+                    if (not narrow_pending[id]) continue;
+                    worklist.push(id);
+                    update_scheduled[id] = true;
+                }
+
+                --iter;
+                continue;
+            }
+            if (out_of_budget()) break;
+
+            int id = worklist.pop();
+            update_scheduled[id] = false;
+            if (skip_narrowing(id)) {
+                --iter;
+                continue;
+            }
+
+            // No changes, so no need to do anything else
+            if (not update(id)) continue;
+
+            DBGS(2) << "  State changed, notifying " << cfg.successors(id).size()
+                    << (cfg.successors(id).size() != 1 ? " successors\n" : " successor\n");
+
+            // Something changed and we will need to update the successors
+            for (int succ: cfg.successors(id)) {
+                if (not update_scheduled[succ]) {
+                    worklist.push(succ);
+                    update_scheduled[succ] = true;
 
-                dbgs(3) << "    Adding " << succ_bb->getName() << " to worklist\n";
+                    DBGS(3) << "    Adding " << cfg.block(succ)->getName() << " to worklist\n";
+                }
             }
         }
     }
 
-    if (!worklist.empty()) {
-        dbgs(0) << "Iteration terminated due to exceeding loop count.\n";
+    if (narrowing_stopped and not counters.budget_exceeded) {
+        DBGS(1) << "\nNarrowing stopped after exceeding the budget of " << iterations_max << " basic blocks\n";
+        counters.budget_exceeded = true;
     }
+    widening_thresholds = nullptr;
+    counters.iterations += iter;
+    countNodes(cfg, states, visits);
+    DBGS(1) << "\nFixpoint iteration finished after " << iter << " iterations\n";
     
     // Output the final result
-    dbgs(0) << "\nFinal result:\n";
-    for (Node const& i: nodes) {
-        dbgs(0) << i.bb->getName() << ":\n";
-        i.state.printOutgoing(*i.bb, dbgs(0), 2);
+    if (output_format == Output_format::TEXT) {
+        DBGS(0) << "\nFinal result:\n";
+        for (int id = 0; id < cfg.size(); ++id) {
+            DBGS(0) << cfg.block(id)->getName() << ":\n";
+            states[id].printOutgoing(*cfg.block(id), dbgs(0), 2);
+        }
+    } else if (output_format == Output_format::JSONL) {
+        // For each value, the state of the block defining it. (Arguments belong to the entry.)
+        std::vector<AbstractState const*> defining (numbering.size(), &states[entry_id]);
+        for (int id = 0; id < cfg.size(); ++id) {
+            for (llvm::Instruction const& inst: *cfg.block(id)) {
+                int value = numbering.lookup(inst);
+                if (value != -1) defining[value] = &states[id];
+            }
+        }
+
+        ValueNames names {f};
+        for (int id = 0; id < cfg.size(); ++id) {
+            states[id].printOutgoingJson(*cfg.block(id), *result_stream, defining, names);
+        }
     }
 }
 
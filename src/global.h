@@ -1,5 +1,8 @@
 #pragma once
 
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace pcpo {
@@ -9,32 +12,98 @@ namespace pcpo {
 //   1: general information about the fixpoint iteration
 //   2: intermediate results in the fixpoint iteration
 //   3: details about the individual operations
-// This could be a compile time constant, but it is not, so that you can set it in your debugger.
+// This is set using -painpass-debug-level, and you can also change it in your debugger. It cannot
+// go higher than DEBUG_LEVEL, though.
 extern int debug_level;
 
-// This is the initial setting
+// The highest level of debug output that is compiled in. Everything above it is removed by the
+// compiler, so in release builds we just keep the result. You can override this when building, e.g.
+// with -DDEBUG_LEVEL=3.
+#ifndef DEBUG_LEVEL
+#ifdef NDEBUG
+#define DEBUG_LEVEL 0
+#else
 #define DEBUG_LEVEL 4
+#endif
+#endif
 
-// This returns either a stream to stderr or to nowhere, depending on whether we are currently
-// outputting that level.
+// Where the debug output of the current thread goes. If this is not set, it is written to stderr
+// directly. When functions are analysed in parallel, each of them gets its own buffer, so that the
+// output can be printed in order afterwards.
+extern thread_local llvm::raw_ostream* debug_stream;
+
+// Whether we are currently outputting that level. For levels above DEBUG_LEVEL, this is known at
+// compile time.
+inline bool debugEnabled(int level) {
+    return level <= DEBUG_LEVEL and level <= debug_level;
+}
+
+// This returns either a stream to stderr (or the buffer of the thread) or to nowhere, depending on
+// whether we are currently outputting that level. Note that the arguments you output are computed
+// either way, so prefer DBGS below, or check debugEnabled first.
 inline llvm::raw_ostream& dbgs(int level) {
-    if (level <= DEBUG_LEVEL) {
-        return llvm::errs();
+    if (debugEnabled(level)) {
+        return debug_stream ? *debug_stream : llvm::errs();
     } else {
         return llvm::nulls();
     }
 }
 
+// Helper for DBGS, this turns the output expression into void, so that it matches the other branch
+// of the conditional.
+struct DebugVoidify {
+    void operator&(llvm::raw_ostream&) {}
+};
+
+// Use this like dbgs(level), i.e. DBGS(2) << "foo" << bar. The difference is that nothing after it is
+// evaluated if the level is not output. This is an expression instead of an if, so that it does not
+// steal the else of a surrounding if.
+#define DBGS(level) \
+    not ::pcpo::debugEnabled(level) ? (void)0 : ::pcpo::DebugVoidify {} & ::pcpo::dbgs(level)
+
 namespace Merge_op {
 
 // see the documentation of AbstractStateDummy::merge for an explanation of what these mean
 // precisely.
 enum Type: int {
-    UPPER_BOUND, WIDEN, NARROW
+    UPPER_BOUND, WIDEN, NARROW, WIDEN_TOP
 };
 
 constexpr char const* name[] = {
-    "joining", "widening", "narrowing"
+    "joining", "widening", "narrowing", "widening to top"
+};
+
+}
+
+// The parts of an instruction with two integer operands of the same type that matter for
+// interpreting it, so that AbstractDomain::interpret does not need to look at the llvm::Instruction.
+// AbstractStateValueSet lowers each basic block into these once, instead of inspecting the
+// instructions again on every visit.
+struct Operation {
+    unsigned opcode = 0; // As returned by llvm::Instruction::getOpcode
+    unsigned predicate = 0; // The llvm::CmpInst::Predicate, for compares
+    unsigned bit_width = 0; // Of the operands
+    bool nuw = false, nsw = false;
+
+    Operation() = default;
+    Operation(llvm::Instruction const& inst, unsigned bit_width): opcode{inst.getOpcode()}, bit_width{bit_width} {
+        if (llvm::CmpInst const* cmp = llvm::dyn_cast<llvm::CmpInst>(&inst)) predicate = cmp->getPredicate();
+        if (llvm::isa<llvm::OverflowingBinaryOperator>(inst)) {
+            nuw = inst.hasNoUnsignedWrap();
+            nsw = inst.hasNoSignedWrap();
+        }
+    }
+};
+
+namespace Scheduling {
+
+// The order in which the fixpoint drivers process the basic blocks.
+//   LIFO: Use a worklist, process the block pushed last.
+//   WTO: Iterate along a weak topological ordering, stabilising loops from the inside out. (See
+//     WeakTopologicalOrder in weak_topological_order.h.) This is only supported with widening.
+//   RPO: Use a worklist, process the block coming first in the reverse post-order of its function.
+enum Type: int {
+    LIFO, WTO, RPO
 };
 
 }
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+namespace pcpo {
+
+// The ranges of the induction variables of simple counted loops, as computed by ScalarEvolution.
+// These are the phi nodes in a loop header that start at a constant and grow by a constant step in
+// each iteration (an affine add-recurrence), where the loop is taken a constant number of times. So
+// their range is known in closed form, e.g. [0, 1000] for the counter of a loop checking i < 1000.
+//  The drivers take these ranges as the values of the phi nodes, instead of the upper bound of their
+// incoming values. This way, the induction variables are stable after the first visit of the loop,
+// and need neither widening nor narrowing, which matters most for deep loop nests, where each inner
+// loop otherwise has to converge again for every iteration of the outer ones.
+//  ScalarEvolution creates constants in the context of the module, so this has to be computed before
+// the functions are analysed in parallel (see runOnModule). They are enabled by -painpass-scev.
+class InductionRanges {
+public:
+    InductionRanges(llvm::Function& f, llvm::TargetLibraryInfo& tli) {
+        llvm::DominatorTree domTree {f};
+        llvm::LoopInfo loopInfo {domTree};
+        llvm::AssumptionCache assumptions {f};
+        llvm::ScalarEvolution se {f, tli, assumptions, domTree, loopInfo};
+
+        for (llvm::Loop* loop: loopInfo.getLoopsInPreorder()) {
+            if (not llvm::isa<llvm::SCEVConstant>(se.getBackedgeTakenCount(loop))) continue;
+
+            for (llvm::PHINode& phi: loop->getHeader()->phis()) {
+                if (not phi.getType()->isIntegerTy()) continue;
+
+                llvm::SCEVAddRecExpr const* rec = llvm::dyn_cast<llvm::SCEVAddRecExpr>(se.getSCEV(&phi));
+                if (not rec or rec->getLoop() != loop or not rec->isAffine()
+                    or not llvm::isa<llvm::SCEVConstant>(rec->getStart())
+                    or not llvm::isa<llvm::SCEVConstant>(rec->getStepRecurrence(se))) {
+                    continue;
+                }
+
+                // Whether the variable wraps around as a signed or as an unsigned number, one of
+                // these is usually exact
+                llvm::ConstantRange range = se.getUnsignedRange(rec);
+                llvm::ConstantRange signed_range = se.getSignedRange(rec);
+                if (signed_range.isSizeStrictlySmallerThan(range)) range = signed_range;
+                if (range.isFullSet() or range.isEmptySet()) continue;
+
+                ranges.insert({&phi, range});
+            }
+        }
+    }
+
+    // Returns the range of phi, or null if it is not the induction variable of a simple counted loop
+    llvm::ConstantRange const* lookup(llvm::PHINode const& phi) const {
+        auto it = ranges.find(&phi);
+        return it != ranges.end() ? &it->second : nullptr;
+    }
+
+private:
+    llvm::DenseMap<llvm::PHINode const*, llvm::ConstantRange> ranges;
+};
+
+// The induction ranges of the function the current thread analyses, or null if there are none
+extern thread_local InductionRanges const* induction_ranges;
+
+} /* end of namespace pcpo */
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace pcpo {
+
+// Calls task(i) for all i in [0, count), using up to thread_count threads (including the calling
+// one). The tasks have to be independent of each other. Whenever a thread is done with a task, it
+// takes the next one that has not been started yet, so the order of the indices is the order in
+// which tasks are started. With a single thread, everything happens in order on the calling thread.
+//  This is a single shared counter instead of per-thread deques with work stealing. That is just as
+// good here, because all tasks are known up front and a task never creates new ones: taking the
+// next index is all the balancing there is to do. If tasks ever spawn work of their own, this needs
+// real work stealing, as a thread would otherwise have to run everything it spawns by itself.
+template <typename Func>
+void parallelFor(int count, int thread_count, Func task) {
+    thread_count = std::min(thread_count, count);
+    if (thread_count <= 1) {
+        for (int i = 0; i < count; ++i) task(i);
+        return;
+    }
+
+    std::atomic<int> next {0};
+    auto work = [&]() {
+        for (int i = next++; i < count; i = next++) task(i);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < thread_count; ++i) threads.emplace_back(work);
+    work();
+    for (std::thread& i: threads) i.join();
+}
+
+} /* end of namespace pcpo */
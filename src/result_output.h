@@ -0,0 +1,82 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "statistics.h"
+
+namespace pcpo {
+
+namespace Output_format {
+
+// How the drivers output their results, set using -painpass-output.
+//   TEXT: The full state leaving each basic block, as part of the debug output.
+//   JSONL: One JSON object per basic block, containing only the values the block defines and the
+//     ones it refines (i.e. those that differ from the state leaving the block defining them).
+//   NONE: Nothing, e.g. for benchmarking.
+enum Type: int {
+    TEXT, JSONL, NONE
+};
+
+}
+
+extern Output_format::Type output_format;
+
+// Where the JSONL results of the current thread go. As for debug_stream, this is a buffer of the
+// function when running in parallel, and the output file (or stderr) otherwise.
+extern thread_local llvm::raw_ostream* result_stream;
+
+// Names the values of a function for the JSON output, the same way the textual IR does. Unnamed
+// values are numbered, which needs a pass over the whole function, so that is only done if there
+// are any.
+class ValueNames {
+public:
+    ValueNames(llvm::Function const& f): f{f} {}
+
+    // Outputs the name of value as a JSON string, e.g. "%x" or "%3"
+    void printJson(llvm::raw_ostream& out, llvm::Value const& value) {
+        llvm::SmallString<32> name;
+        llvm::raw_svector_ostream name_out {name};
+        if (value.hasName()) {
+            name_out << '%' << value.getName();
+        } else {
+            if (not slots) {
+                slots.reset(new llvm::ModuleSlotTracker {f.getParent()});
+                slots->incorporateFunction(f);
+            }
+            value.printAsOperand(name_out, false, *slots);
+        }
+        printJsonString(out, name_out.str());
+    }
+
+    // Outputs the beginning of the object for bb, up to the opening brace of its values
+    void printBlockStart(llvm::raw_ostream& out, llvm::BasicBlock const& bb) {
+        out << "{\"function\": "; printJsonString(out, f.getName());
+        out << ", \"block\": "; printJson(out, bb);
+        out << ", \"values\": {";
+    }
+
+    // Outputs a member of the values, i.e. "%x": "[0, 1]"
+    template <typename AbstractDomain>
+    void printValue(llvm::raw_ostream& out, llvm::Value const& value, AbstractDomain const& abstract, bool first) {
+        llvm::SmallString<32> text;
+        llvm::raw_svector_ostream text_out {text};
+        text_out << abstract;
+
+        if (not first) out << ", ";
+        printJson(out, value);
+        out << ": "; printJsonString(out, text_out.str());
+    }
+
+private:
+    llvm::Function const& f;
+    std::unique_ptr<llvm::ModuleSlotTracker> slots;
+};
+
+} /* end of namespace pcpo */
@@ -1,5 +1,14 @@
 #include "simple_interval.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/MathExtras.h"
+
+#include "widening_thresholds.h"
+
 namespace pcpo {
 
 SimpleInterval::SimpleInterval(llvm::Constant const& constant) {
@@ -24,69 +33,173 @@ SimpleInterval::SimpleInterval(llvm::Constant const& constant) {
     state = TOP;
 }
 
-SimpleInterval::SimpleInterval(APInt _begin, APInt _end) {
-    assert(_begin.getBitWidth() == _end.getBitWidth());
-    state = NORMAL;
-    begin = _begin;
-    end = _end;
+SimpleInterval::SimpleInterval(llvm::ConstantRange const& range) {
+    if (range.isFullSet()) {
+        state = TOP;
+    } else if (range.isEmptySet()) {
+        state = BOTTOM;
+    } else {
+        // Both may wrap around, and the end of the range is exclusive
+        state = NORMAL;
+        begin = range.getLower();
+        end = range.getUpper() - 1;
+    }
+}
+
+SimpleInterval::SimpleInterval(APInt _begin, APInt _end):
+    state{NORMAL}, begin{std::move(_begin)}, end{std::move(_end)}
+{
+    assert(begin.getBitWidth() == end.getBitWidth());
 }
 
 
 // Internal helper functions
 
 using APInt = llvm::APInt;
+using u64 = std::uint64_t;
+
+// Nearly all integers we see have at most 64 bits. APInt already stores those in a single word, but
+// most of its operations are out-of-line calls that first have to check for the general case. So for
+// the operations we use a lot, these helpers work on the raw word directly (keeping the bits above
+// the bit width zero, like APInt does) and only fall back to APInt for wider types. All arguments
+// have to have the same bit width.
+
+static bool ap_native(APInt const& a) {
+    return a.getBitWidth() <= 64;
+}
+static u64 ap_raw(APInt const& a) {
+    return a.getRawData()[0];
+}
+static u64 ap_mask(APInt const& a) {
+    return ~u64 {0} >> (64 - a.getBitWidth());
+}
+// Flipping the sign bit turns a signed comparison into an unsigned one
+static u64 ap_flip(APInt const& a) {
+    return ap_raw(a) ^ u64 {1} << (a.getBitWidth() - 1);
+}
+
+static bool ap_ult(APInt const& a, APInt const& b) { return ap_native(a) ? ap_raw (a) <  ap_raw (b) : a.ult(b); }
+static bool ap_ule(APInt const& a, APInt const& b) { return ap_native(a) ? ap_raw (a) <= ap_raw (b) : a.ule(b); }
+static bool ap_ugt(APInt const& a, APInt const& b) { return ap_native(a) ? ap_raw (a) >  ap_raw (b) : a.ugt(b); }
+static bool ap_uge(APInt const& a, APInt const& b) { return ap_native(a) ? ap_raw (a) >= ap_raw (b) : a.uge(b); }
+static bool ap_slt(APInt const& a, APInt const& b) { return ap_native(a) ? ap_flip(a) <  ap_flip(b) : a.slt(b); }
+static bool ap_sgt(APInt const& a, APInt const& b) { return ap_native(a) ? ap_flip(a) >  ap_flip(b) : a.sgt(b); }
 
-static APInt ap_smin(APInt a, APInt b) {
-    return a.slt(b) ? a : b;
+static APInt ap_add(APInt const& a, APInt const& b) {
+    return ap_native(a) ? APInt {a.getBitWidth(), (ap_raw(a) + ap_raw(b)) & ap_mask(a)} : a + b;
 }
-static APInt ap_umin(APInt a, APInt b) {
-    return a.ult(b) ? a : b;
+static APInt ap_sub(APInt const& a, APInt const& b) {
+    return ap_native(a) ? APInt {a.getBitWidth(), (ap_raw(a) - ap_raw(b)) & ap_mask(a)} : a - b;
+}
+static APInt ap_neg(APInt const& a) {
+    return ap_native(a) ? APInt {a.getBitWidth(), -ap_raw(a) & ap_mask(a)} : -a;
+}
+// Returns a + 1
+static APInt ap_inc(APInt const& a) {
+    return ap_native(a) ? APInt {a.getBitWidth(), (ap_raw(a) + 1) & ap_mask(a)} : a + 1;
 }
 
-static SimpleInterval _icmp_ne(SimpleInterval a, SimpleInterval b) {
+static APInt ap_mul(APInt const& a, APInt const& b) {
+    return ap_native(a) ? APInt {a.getBitWidth(), (ap_raw(a) * ap_raw(b)) & ap_mask(a)} : a * b;
+}
+
+static APInt ap_uadd_ov(APInt const& a, APInt const& b, bool& ov) {
+    if (not ap_native(a)) return a.uadd_ov(b, ov);
+    u64 r = (ap_raw(a) + ap_raw(b)) & ap_mask(a);
+    ov = r < ap_raw(a);
+    return APInt {a.getBitWidth(), r};
+}
+static APInt ap_sadd_ov(APInt const& a, APInt const& b, bool& ov) {
+    if (not ap_native(a)) return a.sadd_ov(b, ov);
+    // Overflow happens if both operands have the same sign, which is different from the result's
+    u64 r = (ap_raw(a) + ap_raw(b)) & ap_mask(a);
+    ov = ((ap_raw(a) ^ r) & (ap_raw(b) ^ r) & u64 {1} << (a.getBitWidth() - 1)) != 0;
+    return APInt {a.getBitWidth(), r};
+}
+static APInt ap_umul_ov(APInt const& a, APInt const& b, bool& ov) {
+    if (not ap_native(a)) return a.umul_ov(b, ov);
+    llvm::SaturatingMultiply(ap_raw(a), ap_raw(b), &ov);
+    u64 r = ap_raw(a) * ap_raw(b);
+    ov |= r > ap_mask(a);
+    return APInt {a.getBitWidth(), r & ap_mask(a)};
+}
+
+// Moves x to the closest of the thresholds (sorted as unsigned numbers) at or beyond it, going up or
+// down, and returns whether there was one. This does not wrap around, as that would jump to the
+// other end of the number range. The threshold also has to come before stop, i.e. the other end of
+// the interval.
+//  _widen passes the bound after taking the upper bound, which already moved past the old one. So
+// if x is a threshold itself, it stays there.
+static bool ap_threshold(APInt const& x, APInt const& stop, bool up, llvm::ArrayRef<APInt> thresholds, APInt& result) {
+    APInt const* t;
+    if (up) {
+        t = std::lower_bound(thresholds.begin(), thresholds.end(), x, WideningThresholds::ult);
+        if (t == thresholds.end()) return false;
+    } else {
+        t = std::upper_bound(thresholds.begin(), thresholds.end(), x, WideningThresholds::ult);
+        if (t == thresholds.begin()) return false;
+        --t;
+    }
+
+    // The number of values we would add, and the number we may add without reaching stop
+    APInt dist = up ? ap_sub(*t, x) : ap_sub(x, *t);
+    APInt room = up ? ap_sub(stop, ap_inc(x)) : ap_sub(x, ap_inc(stop));
+    if (ap_ugt(dist, room)) return false;
+    result = *t;
+    return true;
+}
+
+static APInt const& ap_smin(APInt const& a, APInt const& b) {
+    return ap_slt(a, b) ? a : b;
+}
+static APInt const& ap_umin(APInt const& a, APInt const& b) {
+    return ap_ult(a, b) ? a : b;
+}
+
+static SimpleInterval _icmp_ne(SimpleInterval const& a, SimpleInterval const& b) {
     // Basically, we can only do something if b is a single value that lies at of of the ends of a
     if (b.begin != b.end) return a;
     
-    if (a.begin == a.end + 1) {
+    if (a.begin == ap_inc(a.end)) {
         // a is top, so just exclude the one value
-        return SimpleInterval {b.begin + 1, b.begin - 1};
+        return SimpleInterval {ap_inc(b.begin), ap_sub(b.begin, APInt {b.begin.getBitWidth(), 1})};
     } else if (a.begin == b.begin and a.begin == a.end) {
         // Single value, we want bottom
         return SimpleInterval {};
     } else if (a.begin == b.begin) {
-        return SimpleInterval {a.begin + 1, a.end};
+        return SimpleInterval {ap_inc(a.begin), a.end};
     } else if (a.end == b.begin) {
-        return SimpleInterval {a.begin, a.end - 1};
+        return SimpleInterval {a.begin, ap_sub(a.end, APInt {a.end.getBitWidth(), 1})};
     } else {
         return a;
     }
 }
 
-static SimpleInterval _icmp_ule_val(SimpleInterval a, APInt v) {
-    if (a.begin.ugt(a.end)) {
+static SimpleInterval _icmp_ule_val(SimpleInterval const& a, APInt const& v) {
+    if (ap_ugt(a.begin, a.end)) {
         // Overflow
         return SimpleInterval {
             APInt::getNullValue(a.begin.getBitWidth()),
-            a.begin.ule(v) ? v : ap_umin(a.end, v)
+            ap_ule(a.begin, v) ? v : ap_umin(a.end, v)
         };
-    } else if (v.ult(a.begin)) {
+    } else if (ap_ult(v, a.begin)) {
         return SimpleInterval {};
     } else {
         return SimpleInterval {a.begin, ap_umin(a.end, v)};
     }
 }
 
-static SimpleInterval _icmp_ult_val(SimpleInterval a, APInt v) {
+static SimpleInterval _icmp_ult_val(SimpleInterval const& a, APInt const& v) {
     if (v.isNullValue()) return SimpleInterval();
-    return _icmp_ule_val(a, v-APInt(a.begin.getBitWidth(), 1));
+    return _icmp_ule_val(a, ap_sub(v, APInt(a.begin.getBitWidth(), 1)));
 }
 
-static SimpleInterval _icmp_neg(SimpleInterval a) {
+static SimpleInterval _icmp_neg(SimpleInterval const& a) {
     if (a.isBottom()) return a;
-    return {-a.end, -a.begin};
+    return {ap_neg(a.end), ap_neg(a.begin)};
 }
 
-static SimpleInterval _icmp_inv(SimpleInterval a) {
+static SimpleInterval _icmp_inv(SimpleInterval const& a) {
     if (a.isBottom()) return a;
     return {~a.end, ~a.begin};
 }
@@ -94,11 +207,108 @@ static SimpleInterval _icmp_inv(SimpleInterval a) {
 static SimpleInterval _icmp_shift(SimpleInterval a) {
     if (a.isBottom()) return a;
     APInt q = APInt::getSignedMinValue(a.begin.getBitWidth());
-    a.begin += q;
-    a.end += q;
+    a.begin = ap_add(a.begin, q);
+    a.end = ap_add(a.end, q);
     return a;
 }
 
+
+// The thresholds used by _widen, set by the drivers for the function they analyse
+
+thread_local WideningThresholds const* widening_thresholds = nullptr; // from widening_thresholds.h
+
+
+// The memo cache for interpret and refineBranch
+
+int SimpleInterval::cache_size = 0;
+
+namespace {
+
+struct CacheKey {
+    u64 a_begin, a_end, b_begin, b_end;
+    unsigned op; // Opcode of the instruction, or predicate for refineBranch
+    unsigned width;
+    char kind; // See Cache_kind
+    char flags; // nuw and nsw
+    char a_state, b_state;
+
+    bool operator==(CacheKey const& o) const {
+        return a_begin == o.a_begin and a_end == o.a_end and b_begin == o.b_begin and b_end == o.b_end
+            and op == o.op and width == o.width and kind == o.kind and flags == o.flags
+            and a_state == o.a_state and b_state == o.b_state;
+    }
+};
+
+namespace Cache_kind {
+enum Type: char {
+    INVALID, INTERPRET, ICMP, REFINE_BRANCH
+};
+}
+
+struct CacheEntry {
+    CacheKey key {};
+    SimpleInterval result;
+};
+
+// A direct-mapped table, so a colliding entry simply replaces the old one.
+struct Cache {
+    std::vector<CacheEntry> entries;
+    SimpleInterval::CacheCounters counters;
+};
+
+thread_local Cache cache;
+
+u64 hashKey(CacheKey const& key) {
+    u64 h = key.op | (u64)key.width << 16 | (u64)key.kind << 32 | (u64)key.flags << 40
+        | (u64)key.a_state << 48 | (u64)key.b_state << 56;
+    for (u64 i: {key.a_begin, key.a_end, key.b_begin, key.b_end}) {
+        h = (h ^ i) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+} /* end of anonymous namespace */
+
+SimpleInterval::CacheCounters& SimpleInterval::cacheCounters() {
+    return cache.counters;
+}
+
+// Returns compute(), or the result of an earlier call with the same key. The intervals have to be in
+// the internal representation already, i.e. after _makeTopInterval.
+template <typename Func>
+static SimpleInterval cached(Cache_kind::Type kind, unsigned op, char flags, SimpleInterval const& a,
+        SimpleInterval const& b, unsigned width, Func compute) {
+    if (SimpleInterval::cache_size <= 0 or width > 64) return compute();
+
+    size_t size = llvm::PowerOf2Ceil(SimpleInterval::cache_size);
+    if (cache.entries.size() != size) {
+        cache.entries.clear();
+        cache.entries.resize(size);
+    }
+
+    CacheKey key {};
+    key.op = op;
+    key.width = width;
+    key.kind = kind;
+    key.flags = flags;
+    key.a_state = a.state;
+    key.b_state = b.state;
+    if (a.state == SimpleInterval::NORMAL) { key.a_begin = ap_raw(a.begin); key.a_end = ap_raw(a.end); }
+    if (b.state == SimpleInterval::NORMAL) { key.b_begin = ap_raw(b.begin); key.b_end = ap_raw(b.end); }
+
+    CacheEntry& entry = cache.entries[hashKey(key) & (size-1)];
+    if (entry.key == key) {
+        ++cache.counters.hits;
+        return entry.result;
+    }
+
+    ++cache.counters.misses;
+    entry.key = key;
+    entry.result = compute();
+    return entry.result;
+}
+
 SimpleInterval SimpleInterval::interpret(
     llvm::Instruction const& inst, std::vector<SimpleInterval> const& operands
 ) {    
@@ -111,32 +321,39 @@ SimpleInterval SimpleInterval::interpret(
     unsigned bitWidth = inst.getOperand(0)->getType()->getIntegerBitWidth();
     assert(bitWidth == inst.getOperand(1)->getType()->getIntegerBitWidth());
 
-    SimpleInterval a = operands[0];
-    SimpleInterval b = operands[1];
+    return interpret(Operation {inst, bitWidth}, operands[0], operands[1]);
+}
+
+// The result has an integer type here, only those are lowered into an Operation
+SimpleInterval SimpleInterval::interpret(Operation const& op, SimpleInterval const& a1, SimpleInterval const& a2) {
+    unsigned bitWidth = op.bit_width;
 
     // The following functions do not really want to deal with top. (Keep in mind that we do not
     // need to always returns top, e.g. when doing division.) So instead we pass the full interval.
-    a = a._makeTopInterval(bitWidth);
-    b = b._makeTopInterval(bitWidth);
+    SimpleInterval a = a1._makeTopInterval(bitWidth);
+    SimpleInterval b = a2._makeTopInterval(bitWidth);
 
     // Handle integer compare instructions. This is not really useful, as it just determines whether
     // the comparison can be true or false. The actual branching logic in the value set does a more
     // careful analysis of which conditions lead to a basic block, deriving upper and lower bounds
     // on the variables involved. However, always getting top for the results annoyed me. (In
     // theory, someone could also do computations with them.
-    if (llvm::ICmpInst const* icmp = llvm::dyn_cast<llvm::ICmpInst>(&inst)) {
-        bool f = a.isBottom() or b.isBottom();
-        bool never_true  = f or _refineBranch(icmp->getPredicate(),        a, b).isBottom();
-        bool never_false = f or _refineBranch(icmp->getInversePredicate(), a, b).isBottom();
-        if (never_true and never_false) {
-            return SimpleInterval {};
-        } else if (never_true) {
-            return SimpleInterval {APInt::getNullValue(1), APInt::getNullValue(1)};
-        } else if (never_false) {
-            return SimpleInterval {APInt::getMaxValue(1), APInt::getMaxValue(1)};
-        } else {
-            return SimpleInterval {true};
-        }
+    if (op.opcode == llvm::Instruction::ICmp) {
+        auto pred = (llvm::CmpInst::Predicate)op.predicate;
+        return cached(Cache_kind::ICMP, pred, 0, a, b, bitWidth, [&]() {
+            bool f = a.isBottom() or b.isBottom();
+            bool never_true  = f or _refineBranch(pred,                                     a, b).isBottom();
+            bool never_false = f or _refineBranch(llvm::CmpInst::getInversePredicate(pred), a, b).isBottom();
+            if (never_true and never_false) {
+                return SimpleInterval {};
+            } else if (never_true) {
+                return SimpleInterval {APInt::getNullValue(1), APInt::getNullValue(1)};
+            } else if (never_false) {
+                return SimpleInterval {APInt::getMaxValue(1), APInt::getMaxValue(1)};
+            } else {
+                return SimpleInterval {true};
+            }
+        });
     }
 
     // We need to check for bottom after determining the type of the operation, because some weird
@@ -144,15 +361,20 @@ SimpleInterval SimpleInterval::interpret(
     // the layer above.)
 
 #define DO_BINARY_OV(x)                                                 \
-    case llvm::Instruction::x:                                          \
+    case llvm::Instruction::x: {                                        \
         if (a.isBottom() or b.isBottom()) return SimpleInterval {};     \
-        return a._##x(b, inst.hasNoUnsignedWrap(), inst.hasNoSignedWrap())._makeTopSpecial();
+        return cached(Cache_kind::INTERPRET, op.opcode, op.nuw | op.nsw << 1, a, b, bitWidth, [&]() { \
+            return a._##x(b, op.nuw, op.nsw)._makeTopSpecial();         \
+        });                                                             \
+    }
 #define DO_BINARY(x)                                                    \
     case llvm::Instruction::x:                                          \
         if (a.isBottom() or b.isBottom()) return SimpleInterval {};     \
-        return a._##x(b)._makeTopSpecial();
+        return cached(Cache_kind::INTERPRET, op.opcode, 0, a, b, bitWidth, [&]() { \
+            return a._##x(b)._makeTopSpecial();                         \
+        });
     
-    switch (inst.getOpcode()) {
+    switch (op.opcode) {
         DO_BINARY_OV(Add);
         DO_BINARY_OV(Sub);
         DO_BINARY_OV(Mul);
@@ -169,7 +391,7 @@ SimpleInterval SimpleInterval::interpret(
 
 SimpleInterval SimpleInterval::refineBranch(
     llvm::CmpInst::Predicate pred, llvm::Value const& lhs, llvm::Value const& rhs,
-    SimpleInterval a1, SimpleInterval a2
+    SimpleInterval const& a1, SimpleInterval const& a2
 ) {
     // Here we do all the checks for top and bottom, so that the code below does not have to deal
     // with them.
@@ -182,14 +404,15 @@ SimpleInterval SimpleInterval::refineBranch(
     unsigned bitWidth = type->getBitWidth();
     assert(bitWidth == rhs.getType()->getIntegerBitWidth());
     
-    a1 = a1._makeTopInterval(bitWidth);
-    a2 = a2._makeTopInterval(bitWidth);
-
-    return _refineBranch(pred, a1, a2)._makeTopSpecial();
+    SimpleInterval a = a1._makeTopInterval(bitWidth);
+    SimpleInterval b = a2._makeTopInterval(bitWidth);
+    return cached(Cache_kind::REFINE_BRANCH, pred, 0, a, b, bitWidth, [&]() {
+        return _refineBranch(pred, a, b)._makeTopSpecial();
+    });
 }
 
 SimpleInterval SimpleInterval::_refineBranch(
-    llvm::CmpInst::Predicate pred, SimpleInterval a1, SimpleInterval a2
+    llvm::CmpInst::Predicate pred, SimpleInterval const& a1, SimpleInterval const& a2
 ) {
     using Predicate = llvm::CmpInst::Predicate;
     
@@ -214,7 +437,7 @@ SimpleInterval SimpleInterval::_refineBranch(
     }
 }
 
-SimpleInterval SimpleInterval::merge(Merge_op::Type op, SimpleInterval a, SimpleInterval b) {
+SimpleInterval SimpleInterval::merge(Merge_op::Type op, SimpleInterval const& a, SimpleInterval const& b) {
     if (a.isBottom()) return b;
     if (b.isBottom()) return a;
     if (a.isTop() || b.isTop()) return SimpleInterval {true};
@@ -225,6 +448,10 @@ SimpleInterval SimpleInterval::merge(Merge_op::Type op, SimpleInterval a, Simple
     case Merge_op::UPPER_BOUND: return a._upperBound(b)._makeTopSpecial();
     case Merge_op::WIDEN:       return a._widen     (b)._makeTopSpecial();
     case Merge_op::NARROW:      return a._narrow    (b)._makeTopSpecial();
+    case Merge_op::WIDEN_TOP: {
+        SimpleInterval c = a._upperBound(b)._makeTopSpecial();
+        return c == a ? a : SimpleInterval {true};
+    }
     default:
         assert(false /* invalid op value */);
         return SimpleInterval {true};
@@ -232,20 +459,30 @@ SimpleInterval SimpleInterval::merge(Merge_op::Type op, SimpleInterval a, Simple
 }
 
 
-bool SimpleInterval::operator==(SimpleInterval o) const {
+bool SimpleInterval::operator==(SimpleInterval const& o) const {
+    // Intervals of different bit widths may be compared when interning values, so those have to be
+    // handled before APInt asserts on them
     return state == NORMAL
-        ? o.state == NORMAL and begin == o.begin and end == o.end
+        ? o.state == NORMAL and begin.getBitWidth() == o.begin.getBitWidth()
+            and begin == o.begin and end == o.end
         : state == o.state;
 }
 
-bool SimpleInterval::contains(APInt value) const {
+llvm::hash_code hash_value(SimpleInterval const& a) {
+    // The hash of an APInt includes its bit width
+    return a.state == SimpleInterval::NORMAL
+        ? llvm::hash_combine(a.state, a.begin, a.end)
+        : llvm::hash_value(a.state);
+}
+
+bool SimpleInterval::contains(APInt const& value) const {
     if (state != NORMAL) return state == TOP;
 
     assert(value.getBitWidth() == begin.getBitWidth());
     return _innerLe(value, end);
 }
 
-llvm::raw_ostream& operator<<(llvm::raw_ostream& os, SimpleInterval a) {
+llvm::raw_ostream& operator<<(llvm::raw_ostream& os, SimpleInterval const& a) {
     if (a.isBottom()) {
         os << "[]";
     } else if(a.isTop()) {
@@ -284,50 +521,47 @@ SimpleInterval SimpleInterval::_makeTopInterval(unsigned bitWidth) const {
 // This does the reverse transformation. If the interval contains every value, we return the special
 // value top instead.
 SimpleInterval SimpleInterval::_makeTopSpecial() const {
-    if (begin == end + 1) {
+    if (begin == ap_inc(end)) {
         return SimpleInterval {true};
     } else {
         return *this;
     }
 }
 
-SimpleInterval SimpleInterval::_Add (SimpleInterval o, bool nuw, bool nsw) const {
-    if (nuw && begin.ule(end) && o.begin.ule(o.end)) {
+SimpleInterval SimpleInterval::_Add (SimpleInterval const& o, bool nuw, bool nsw) const {
+    if (nuw && ap_ule(begin, end) && ap_ule(o.begin, o.end)) {
         bool ov;
-        APInt r_begin = begin.uadd_ov(o.begin, ov);
+        APInt r_begin = ap_uadd_ov(begin, o.begin, ov);
         if (ov) return SimpleInterval(); // bottom
-        APInt r_end = end.uadd_ov(o.end, ov);
-        r_end = APInt::getMaxValue(begin.getBitWidth());
-        return SimpleInterval(r_begin, r_end);
+        APInt r_end = APInt::getMaxValue(begin.getBitWidth());
+        return SimpleInterval(std::move(r_begin), std::move(r_end));
     }
 
-    if (nsw && begin.sle(end) && o.begin.sle(o.end)) {
+    if (nsw && !ap_sgt(begin, end) && !ap_sgt(o.begin, o.end)) {
         bool ov;
-        APInt r_begin = begin.sadd_ov(o.begin, ov);
+        APInt r_begin = ap_sadd_ov(begin, o.begin, ov);
         if (ov && !begin.isNegative()) return SimpleInterval(); // bottom
         if (ov &&  begin.isNegative()) r_begin = APInt::getSignedMinValue(begin.getBitWidth());
-        APInt r_end = end.sadd_ov(o.end, ov);
+        APInt r_end = ap_sadd_ov(end, o.end, ov);
         if (ov &&  end.isNegative())   return SimpleInterval(); // bottom
         if (ov && !end.isNegative())   r_end = APInt::getSignedMaxValue(begin.getBitWidth());
-        return SimpleInterval(r_begin, r_end);
+        return SimpleInterval(std::move(r_begin), std::move(r_end));
     }
 
     {
         bool ov;
-        (end - begin).uadd_ov(o.end - o.begin, ov);
+        ap_uadd_ov(ap_sub(end, begin), ap_sub(o.end, o.begin), ov);
         if (ov) return SimpleInterval(true);
-        APInt r_begin = begin + o.begin;
-        APInt r_end   = end   + o.end;
-        return SimpleInterval(r_begin, r_end);
+        return SimpleInterval(ap_add(begin, o.begin), ap_add(end, o.end));
     }
 }
 
 
-SimpleInterval SimpleInterval::_Sub (SimpleInterval o, bool nuw, bool nsw) const {
+SimpleInterval SimpleInterval::_Sub (SimpleInterval const& o, bool nuw, bool nsw) const {
     return _Add(_icmp_neg(o), false, false);
 }
 
-SimpleInterval SimpleInterval::_Mul (SimpleInterval o, bool nuw, bool nsw) const {
+SimpleInterval SimpleInterval::_Mul (SimpleInterval const& o, bool nuw, bool nsw) const {
     // Multiplication results do not depend on signedness. So we just flip signs
     // to find the best configuration. Also, just ignore nuw and nsw for now.
 
@@ -342,25 +576,27 @@ SimpleInterval SimpleInterval::_Mul (SimpleInterval o, bool nuw, bool nsw) const
         SimpleInterval rhs = o;
         if (i&1) {
             // Flip lhs
-            lhs.begin = -end;
-            lhs.end = -begin;
+            lhs.begin = ap_neg(end);
+            lhs.end = ap_neg(begin);
         }
         if (i&2) {
             // Flip rhs
-            rhs.begin = -o.end;
-            rhs.end = -o.begin;
+            rhs.begin = ap_neg(o.end);
+            rhs.end = ap_neg(o.begin);
         }
 
-        // Check whether the unsigned multiplication overflows
+        // Check whether the unsigned multiplication overflows. If not, neither does the one of the
+        // lower bounds.
         bool ov;
-        APInt i_end = lhs._umax().umul_ov(rhs._umax(), ov);
-        APInt i_begin = lhs._umin() * rhs._umin();
-        if (!ov && (i_end - i_begin).ult(u_size)) {
-            u_size = i_end - i_begin;
+        APInt i_end = ap_umul_ov(lhs._umax(), rhs._umax(), ov);
+        if (ov) continue;
+        APInt i_begin = ap_mul(lhs._umin(), rhs._umin());
+        if (ap_ult(ap_sub(i_end, i_begin), u_size)) {
+            u_size = ap_sub(i_end, i_begin);
             assert(i_begin.ule(i_end));
             if (r_flip) {
-                u_end = -i_begin;
-                u_begin = -i_end;
+                u_end = ap_neg(i_begin);
+                u_begin = ap_neg(i_end);
             } else {
                 u_begin = i_begin;
                 u_end = i_end;
@@ -375,7 +611,7 @@ SimpleInterval SimpleInterval::_Mul (SimpleInterval o, bool nuw, bool nsw) const
     }
 }
 
-SimpleInterval SimpleInterval::_UDiv (SimpleInterval o) const {
+SimpleInterval SimpleInterval::_UDiv (SimpleInterval const& o) const {
     // No interest in dividing by zero later
     APInt o_begin = o.begin;
     APInt o_end = o.end;
@@ -389,7 +625,7 @@ SimpleInterval SimpleInterval::_UDiv (SimpleInterval o) const {
     }
 
     SimpleInterval r_result (begin, end);
-    int wrapflags = begin.ugt(end) << 1 | o_begin.ugt(o_end);
+    int wrapflags = ap_ugt(begin, end) << 1 | ap_ugt(o_begin, o_end);
     
     if (wrapflags == 0) {
         // No wraps. Life is simple here.
@@ -411,22 +647,22 @@ SimpleInterval SimpleInterval::_UDiv (SimpleInterval o) const {
 }
 
 
-SimpleInterval SimpleInterval::_URem (SimpleInterval o) const {
-    if (_umax().ule(o._umax())) {
+SimpleInterval SimpleInterval::_URem (SimpleInterval const& o) const {
+    if (ap_ule(_umax(), o._umax())) {
         return SimpleInterval(APInt::getMinValue(begin.getBitWidth()), _umax());
     } else {
         return SimpleInterval(APInt::getMinValue(begin.getBitWidth()), o._umax());
     }
 }
 
-SimpleInterval SimpleInterval::_SRem (SimpleInterval o) const {
+SimpleInterval SimpleInterval::_SRem (SimpleInterval const& o) const {
     SimpleInterval r {begin, end};
 
     // Can we have negative results?
     if (_smin().isNegative()) {
         // Yes. Find the smallest (i.e. most negative) one
         r.begin = _smin();
-        if (o._smaxabsneg().sgt(r.begin)) r.begin = o._smaxabsneg();
+        if (ap_sgt(o._smaxabsneg(), r.begin)) r.begin = o._smaxabsneg();
     } else {
         r.begin = APInt::getNullValue(begin.getBitWidth());
     }
@@ -435,7 +671,7 @@ SimpleInterval SimpleInterval::_SRem (SimpleInterval o) const {
     if (_smax().isNonNegative()) {
         // Yes. Find the largest one
         r.end = _smax();
-        if (o._smaxabsneg().sgt(-r.end)) r.end = -o._smaxabsneg();
+        if (ap_sgt(o._smaxabsneg(), ap_neg(r.end))) r.end = ap_neg(o._smaxabsneg());
     } else {
         r.end = APInt::getNullValue(begin.getBitWidth());
     }
@@ -443,7 +679,7 @@ SimpleInterval SimpleInterval::_SRem (SimpleInterval o) const {
     return SimpleInterval(r);
 }
 
-SimpleInterval SimpleInterval::_upperBound(SimpleInterval o) const {
+SimpleInterval SimpleInterval::_upperBound(SimpleInterval const& o) const {
     int overflag = contains(o.begin) << 1 | contains(o.end);
     if (overflag == 0) {
         // We do not contain any of o, but the reverse may hold
@@ -454,7 +690,7 @@ SimpleInterval SimpleInterval::_upperBound(SimpleInterval o) const {
         }
         
         // No overlap, so choose the smaller one
-        if ((o.end-begin).ule(end-o.begin)) {
+        if (ap_ule(ap_sub(o.end, begin), ap_sub(end, o.begin))) {
             return SimpleInterval {begin, o.end};
         } else {
             return SimpleInterval {o.begin, end};
@@ -475,24 +711,38 @@ SimpleInterval SimpleInterval::_upperBound(SimpleInterval o) const {
     }
 }
 
-SimpleInterval SimpleInterval::_widen(SimpleInterval o) const {
-    APInt incr = end - begin;;
-    if (incr.uge(APInt::getSignedMaxValue(begin.getBitWidth()))) {
+SimpleInterval SimpleInterval::_widen(SimpleInterval const& o) const {
+    APInt incr = ap_sub(end, begin);
+    if (ap_uge(incr, APInt::getSignedMaxValue(begin.getBitWidth()))) {
         // Too large already, return true
         return SimpleInterval(true);
     } 
 
-    // Widen the sides that changed
+    // Widen the sides that changed. If there is a threshold in that direction (before reaching the
+    // other side), we go there instead.
     SimpleInterval r = _upperBound(o);
     int flags = (r.begin != begin) | (r.end != end) << 1;
     incr.ashrInPlace(flags == 3 ? 1 : 0); // Divide by two if we widen into both directions
     incr += incr.isNullValue(); // Always widen by at least 1
-    if (flags & 1) r.begin -= incr;
-    if (flags & 2) r.end   += incr;
+    llvm::ArrayRef<APInt> lower, upper;
+    if (widening_thresholds) {
+        lower = widening_thresholds->get(begin.getBitWidth(), false);
+        upper = widening_thresholds->get(begin.getBitWidth(), true);
+    }
+
+    // If the step would reach the other side, the result wraps around and contains everything.
+    if (flags & 1 and not ap_threshold(r.begin, r.end, false, lower, r.begin)) {
+        if (ap_ugt(incr, ap_sub(r.begin, ap_inc(r.end)))) return SimpleInterval(true);
+        r.begin = ap_sub(r.begin, incr);
+    }
+    if (flags & 2 and not ap_threshold(r.end, r.begin, true, upper, r.end)) {
+        if (ap_ugt(incr, ap_sub(r.begin, ap_inc(r.end)))) return SimpleInterval(true);
+        r.end = ap_add(r.end, incr);
+    }
     return r;
 }
 
-SimpleInterval SimpleInterval::_narrow(SimpleInterval o) const {
+SimpleInterval SimpleInterval::_narrow(SimpleInterval const& o) const {
     int overflag = contains(o.begin) << 1 | contains(o.end);
     if (overflag == 0) {
         // We do not contain any of o, but the reverse may hold
@@ -522,7 +772,7 @@ SimpleInterval SimpleInterval::_narrow(SimpleInterval o) const {
     }
 }
 
-bool SimpleInterval::operator<=(SimpleInterval o) const {
+bool SimpleInterval::operator<=(SimpleInterval const& o) const {
     if (state != NORMAL or o.state != NORMAL) {
         return state <= o.state;
     }
@@ -531,30 +781,33 @@ bool SimpleInterval::operator<=(SimpleInterval o) const {
 }
 
 APInt SimpleInterval::_umax() const {
-    return begin.ugt(end) ? APInt::getMaxValue(begin.getBitWidth()) : end;
+    return ap_ugt(begin, end) ? APInt::getMaxValue(begin.getBitWidth()) : end;
 }
 APInt SimpleInterval::_umin() const {
-    return begin.ugt(end) ? APInt::getMinValue(begin.getBitWidth()) : begin;
+    return ap_ugt(begin, end) ? APInt::getMinValue(begin.getBitWidth()) : begin;
 }
 APInt SimpleInterval::_smax() const {
-    return begin.sgt(end) ? APInt::getSignedMaxValue(begin.getBitWidth()) : end;
+    return ap_sgt(begin, end) ? APInt::getSignedMaxValue(begin.getBitWidth()) : end;
 }
 APInt SimpleInterval::_smin() const {
-    return begin.sgt(end) ? APInt::getSignedMinValue(begin.getBitWidth()) : begin;
+    return ap_sgt(begin, end) ? APInt::getSignedMinValue(begin.getBitWidth()) : begin;
 }
 
 APInt SimpleInterval::_smaxabsneg() const {
-    if (begin.sgt(end)) {
+    if (ap_sgt(begin, end)) {
         // Our interval contains a signed wrap
         return APInt::getSignedMinValue(begin.getBitWidth());
     } else {
-        return ap_smin(begin.isNegative() ? begin : -begin, end.isNegative() ? end : -end);
+        return ap_smin(begin.isNegative() ? begin : ap_neg(begin), end.isNegative() ? end : ap_neg(end));
     }
 }
 
-bool SimpleInterval::_innerLe(APInt a, APInt b) const {
+bool SimpleInterval::_innerLe(APInt const& a, APInt const& b) const {
     // Return whether a <= b relative to the interval. So if both a, b are inside, then a <= b iff a
     // is no farther from begin than b.
+    if (ap_native(a)) {
+        return ((ap_raw(a) - ap_raw(begin)) & ap_mask(a)) <= ((ap_raw(b) - ap_raw(begin)) & ap_mask(a));
+    }
     return (a - begin).ule(b - begin);
 }
 
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/Hashing.h>
 #include <llvm/IR/Constant.h>
+#include <llvm/IR/ConstantRange.h>
 #include <llvm/IR/Instructions.h>
 
 #include "global.h"
@@ -35,29 +37,44 @@ public:
     // The AbstractDomain interface
     SimpleInterval(bool isTop = false): state{isTop ? TOP : BOTTOM} {}
     SimpleInterval(llvm::Constant const& constant);
+    SimpleInterval(llvm::ConstantRange const& range);
     static SimpleInterval interpret(
         llvm::Instruction const& inst, std::vector<SimpleInterval> const& operands
     );
+    static SimpleInterval interpret(Operation const& op, SimpleInterval const& a, SimpleInterval const& b);
     static SimpleInterval refineBranch(
         llvm::CmpInst::Predicate pred, llvm::Value const& lhs, llvm::Value const& rhs,
-        SimpleInterval a, SimpleInterval b
+        SimpleInterval const& a, SimpleInterval const& b
     );
-    static SimpleInterval merge(Merge_op::Type op, SimpleInterval a, SimpleInterval b);
+    static SimpleInterval merge(Merge_op::Type op, SimpleInterval const& a, SimpleInterval const& b);
 
     // Other functions
 
+    // The results of interpret and refineBranch can be memoised in a cache, keyed on the operation
+    // and the intervals of the operands. Each thread has its own cache, with this many entries
+    // (rounded up to a power of two). It is set using -painpass-memo-size, 0 disables the cache.
+    // Only bit widths of up to 64 are cached.
+    static int cache_size;
+
+    struct CacheCounters {
+        long hits = 0;
+        long misses = 0;
+    };
+    // Returns the counters of the cache of the calling thread
+    static CacheCounters& cacheCounters();
+
     // Warning: This function does not normalise top, i.e. it always has state==NORMAL, even if it
     // contains all values. You might want to call _makeTopSpecial() afterwards.
     SimpleInterval(APInt _begin, APInt _end);
 
-    bool operator==(SimpleInterval other) const;
-    bool operator!=(SimpleInterval other) const {return !(*this == other);}
-    bool operator<= (SimpleInterval o) const;
+    bool operator==(SimpleInterval const& other) const;
+    bool operator!=(SimpleInterval const& other) const {return !(*this == other);}
+    bool operator<= (SimpleInterval const& o) const;
     
     bool isTop() const { return state == TOP; };
     bool isBottom() const { return state == BOTTOM; };
     
-    bool contains(APInt value) const;
+    bool contains(APInt const& value) const;
 
     // You can call this from your debugger
     void printOut() const;
@@ -66,21 +83,23 @@ public:
     // they use the interval representation of top (i.e. [a+1, a] for some a). If you call one of
     // these, you have to take care to deal with those values beforehand, and convert the result
     // into normal form by calling _makeTopSpecial.
+    //  For bit widths of up to 64, most of these do their arithmetic on native words instead of
+    // going through APInt (see the ap_* helpers in simple_interval.cpp).
     
     SimpleInterval _makeTopInterval(unsigned bitWidth) const;
     SimpleInterval _makeTopSpecial() const;
-    SimpleInterval _Add (SimpleInterval o, bool nuw, bool nsw) const;
-    SimpleInterval _Sub (SimpleInterval o, bool nuw, bool nsw) const;
-    SimpleInterval _Mul (SimpleInterval o, bool nuw, bool nsw) const;
-    SimpleInterval _UDiv(SimpleInterval o) const;
-    SimpleInterval _URem(SimpleInterval o) const;
-    SimpleInterval _SRem(SimpleInterval o) const;
-    SimpleInterval _upperBound(SimpleInterval o) const;
-    SimpleInterval _widen(SimpleInterval o) const;
-    SimpleInterval _narrow(SimpleInterval o) const;
+    SimpleInterval _Add (SimpleInterval const& o, bool nuw, bool nsw) const;
+    SimpleInterval _Sub (SimpleInterval const& o, bool nuw, bool nsw) const;
+    SimpleInterval _Mul (SimpleInterval const& o, bool nuw, bool nsw) const;
+    SimpleInterval _UDiv(SimpleInterval const& o) const;
+    SimpleInterval _URem(SimpleInterval const& o) const;
+    SimpleInterval _SRem(SimpleInterval const& o) const;
+    SimpleInterval _upperBound(SimpleInterval const& o) const;
+    SimpleInterval _widen(SimpleInterval const& o) const;
+    SimpleInterval _narrow(SimpleInterval const& o) const;
 
     static SimpleInterval _refineBranch(
-        llvm::CmpInst::Predicate pred, SimpleInterval a, SimpleInterval b
+        llvm::CmpInst::Predicate pred, SimpleInterval const& a, SimpleInterval const& b
     );
     
     APInt _umax() const;
@@ -88,9 +107,12 @@ public:
     APInt _smax() const;
     APInt _smin() const;
     APInt _smaxabsneg() const;
-    bool _innerLe(APInt a, APInt b) const;    
+    bool _innerLe(APInt const& a, APInt const& b) const;
 };
 
-llvm::raw_ostream& operator<<(llvm::raw_ostream& os, SimpleInterval a);
+llvm::raw_ostream& operator<<(llvm::raw_ostream& os, SimpleInterval const& a);
+
+// Used by ValueInterner, equal intervals have the same hash
+llvm::hash_code hash_value(SimpleInterval const& a);
 
 } /* end of namespace pcpo */
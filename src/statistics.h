@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace pcpo {
+
+// Counters about the analysis of a single function. A function is analysed by a single thread, so
+// these are kept per thread. runOnModule resets them before running a driver, and reports them
+// afterwards if -painpass-stats is set. The totals over the module also go into LLVM's -stats.
+//  The ones starting with max_block_visits are only collected by executeFixpointAlgorithm and
+// executeFixpointAlgorithmWidening.
+struct Counters {
+    long iterations = 0; // Number of basic blocks processed (for the sparse algorithm: instructions)
+    bool budget_exceeded = false; // Whether the iteration exceeded its budget (see iterationBudget)
+    long transfer_calls = 0; // Number of calls to AbstractDomain::interpret
+    long memo_hits = 0; // Lookups in the cache of SimpleInterval that were found (see -painpass-memo-size)
+    long memo_misses = 0; // Lookups in the cache that were not
+
+    long max_block_visits = 0; // Largest number of times a single basic block was processed
+    llvm::StringRef hottest_block; // The name of that basic block
+    long widen_merges = 0; // Merges into the stored state of a block using WIDEN
+    long narrow_merges = 0; // Merges into the stored state of a block using NARROW
+    long changed_merges = 0; // Merges into the stored state of a block that changed it
+    long max_state_values = 0; // Largest number of values in the final state of a block
+    long total_state_values = 0; // Number of values in the final states of all blocks
+
+    // Time spent in the operations of the states, only measured if profiling is set
+    double apply_seconds = 0;
+    double merge_seconds = 0;
+    double branch_seconds = 0;
+};
+
+extern thread_local Counters counters;
+
+// Whether the drivers measure the time spent in apply, merge and branch. Reading the clock costs
+// about as much as a small transfer function, so this is only done if someone asks for the
+// statistics.
+extern bool profiling;
+
+// Adds the time until the end of the scope to seconds, if profiling is set
+class ProfileTimer {
+public:
+    ProfileTimer(double& seconds): seconds{profiling ? &seconds : nullptr} {
+        if (this->seconds) time_start = std::chrono::steady_clock::now();
+    }
+    ~ProfileTimer() {
+        if (not seconds) return;
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - time_start;
+        *seconds += time.count();
+    }
+
+private:
+    double* seconds;
+    std::chrono::steady_clock::time_point time_start;
+};
+
+// Fills in the counters about the nodes of the CFG after a driver is done. states and visits are
+// indexed by the ids of the nodes in cfg, as in executeFixpointAlgorithm.
+template <typename Graph, typename AbstractState>
+void countNodes(Graph const& cfg, std::vector<AbstractState> const& states, std::vector<int> const& visits) {
+    for (int id = 0; id < cfg.size(); ++id) {
+        if (visits[id] > counters.max_block_visits) {
+            counters.max_block_visits = visits[id];
+            counters.hottest_block = cfg.block(id)->getName();
+        }
+        long values = states[id].valueCount();
+        counters.max_state_values = std::max(counters.max_state_values, values);
+        counters.total_state_values += values;
+    }
+}
+
+// Outputs s as a JSON string, including the quotes
+inline void printJsonString(llvm::raw_ostream& out, llvm::StringRef s) {
+    out << '"';
+    for (char c: s) {
+        if (c == '"' or c == '\\') {
+            out << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            out << llvm::format("\\u%04x", (int)c);
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+} /* end of namespace pcpo */
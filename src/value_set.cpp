@@ -2,6 +2,139 @@
 
 namespace pcpo {
 
+ValueNumbering::ValueNumbering(llvm::Function const& f) {
+    for (llvm::Argument const& arg: f.args()) {
+        ids[&arg] = values.size();
+        values.push_back(&arg);
+    }
+    for (llvm::BasicBlock const& bb: f) {
+        for (llvm::Instruction const& inst: bb) {
+            // Instructions without a result never end up in a state
+            if (inst.getType()->isVoidTy()) continue;
+            
+            ids[&inst] = values.size();
+            values.push_back(&inst);
+        }
+    }
+
+    // For each incoming value of a phi node, find the position of its block in the predecessors.
+    // With duplicate predecessors (e.g. from a switch), the first one is taken.
+    phi_offsets.assign(values.size(), -1);
+    llvm::DenseMap<llvm::BasicBlock const*, int> pred_index;
+    for (llvm::BasicBlock const& bb: f) {
+        if (not llvm::isa<llvm::PHINode>(bb.front())) continue;
+
+        pred_index.clear();
+        int index = 0;
+        for (llvm::BasicBlock const* pred_bb: llvm::predecessors(&bb)) {
+            pred_index.insert({pred_bb, index++});
+        }
+
+        for (llvm::PHINode const& phi: bb.phis()) {
+            phi_offsets[ids[&phi]] = phi_preds.size();
+            for (unsigned i = 0; i < phi.getNumIncomingValues(); ++i) {
+                phi_preds.push_back(pred_index.lookup(phi.getIncomingBlock(i)));
+            }
+        }
+    }
+}
+
+std::vector<int> const& ValueNumbering::readValues(llvm::BasicBlock const& bb) const {
+    auto it = read_values.find(&bb);
+    if (it != read_values.end()) return it->second;
+
+    std::vector<int>& result = read_values[&bb];
+    for (llvm::Instruction const& inst: bb) {
+        for (llvm::Value const* value: inst.operand_values()) {
+            int id = lookup(*value);
+            llvm::Instruction const* value_inst = llvm::dyn_cast<llvm::Instruction>(value);
+            if (id != -1 and not (value_inst and value_inst->getParent() == &bb)) result.push_back(id);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// The uses of each value are followed backwards to its definition, marking it live on the way. The
+// values are processed in order, so checking the last element is enough to avoid duplicates, and the
+// lists end up sorted.
+Liveness::Liveness(llvm::Function const& f, ValueNumbering const& numbering) {
+    int index = 0;
+    for (llvm::BasicBlock const& bb: f) blocks[&bb] = index++;
+    std::vector<std::vector<int>> live_in (blocks.size());
+    std::vector<std::vector<int>> live_out (blocks.size());
+
+    auto mark = [](std::vector<int>& values, int id) {
+        if (not values.empty() and values.back() == id) return false;
+        values.push_back(id);
+        return true;
+    };
+
+    std::vector<llvm::BasicBlock const*> stack; // Blocks the value is live at the start of
+    for (int id = 0; id < numbering.size(); ++id) {
+        llvm::Value const* value = numbering.value(id);
+        llvm::Instruction const* inst = llvm::dyn_cast<llvm::Instruction>(value);
+        llvm::BasicBlock const* def_bb = inst ? inst->getParent() : &f.getEntryBlock();
+
+        auto useIn = [&](llvm::BasicBlock const* bb) {
+            if (bb != def_bb) stack.push_back(bb);
+        };
+        for (llvm::Use const& use: value->uses()) {
+            llvm::Instruction const* user = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+            if (not user) continue;
+
+            if (llvm::PHINode const* phi = llvm::dyn_cast<llvm::PHINode>(user)) {
+                // The value is read at the end of the incoming block
+                llvm::BasicBlock const* pred = phi->getIncomingBlock(use);
+                if (mark(live_out[blocks[pred]], id)) useIn(pred);
+            } else {
+                useIn(user->getParent());
+                if (llvm::isa<llvm::ICmpInst>(user)) {
+                    for (llvm::User const* cmp_user: user->users()) {
+                        if (llvm::isa<llvm::BranchInst>(cmp_user)) useIn(llvm::cast<llvm::Instruction>(cmp_user)->getParent());
+                    }
+                }
+            }
+
+            while (not stack.empty()) {
+                llvm::BasicBlock const* bb = stack.back();
+                stack.pop_back();
+                if (not mark(live_in[blocks[bb]], id)) continue;
+
+                for (llvm::BasicBlock const* pred: llvm::predecessors(bb)) {
+                    if (mark(live_out[blocks[pred]], id)) useIn(pred);
+                }
+            }
+        }
+    }
+
+    kept = std::move(live_out);
+    for (llvm::BasicBlock const& bb: f) {
+        std::vector<int>& values = kept[blocks[&bb]];
+        if (&bb == &f.getEntryBlock()) {
+            for (llvm::Argument const& arg: f.args()) values.push_back(numbering.lookup(arg));
+        }
+        for (llvm::Instruction const& inst: bb) {
+            int id = numbering.lookup(inst);
+            if (id != -1) values.push_back(id);
+        }
+
+        llvm::BranchInst const* branch = llvm::dyn_cast<llvm::BranchInst>(bb.getTerminator());
+        if (branch and branch->isConditional()) {
+            if (llvm::ICmpInst const* cmp = llvm::dyn_cast<llvm::ICmpInst>(branch->getCondition())) {
+                for (llvm::Value const* operand: cmp->operand_values()) {
+                    int id = numbering.lookup(*operand);
+                    if (id != -1) values.push_back(id);
+                }
+            }
+        }
+
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+    }
+}
+
 char const* get_predicate_name(llvm::CmpInst::Predicate pred) {
     using Predicate = llvm::CmpInst::Predicate;
     switch (pred) {
@@ -1,15 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constant.h"
+#include "llvm/IR/ConstantRange.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/Support/MathExtras.h"
 
 #include "global.h"
+#include "induction_ranges.h"
+#include "result_output.h"
+#include "statistics.h"
 
 namespace pcpo {
 
@@ -27,6 +39,10 @@ public:
     // Initialise from a constant
     AbstractDomainDummy(llvm::Constant const& constant): AbstractDomainDummy(true) {}
 
+    // Initialise from a range of integers, which may wrap around. This is used for the induction
+    // variables whose range ScalarEvolution knows (see InductionRanges).
+    AbstractDomainDummy(llvm::ConstantRange const& range): AbstractDomainDummy(true) {}
+
     // This method does the actual abstract interpretation by executing the instruction on the
     // abstract domain, return (an upper bound of) the result. Relevant instructions are mostly the
     // arithmetic ones (like add, sub, mul, etc.). Comparisons are handled mostly using
@@ -36,9 +52,22 @@ public:
         llvm::Instruction const& inst, std::vector<AbstractDomainDummy> const& operands
     ) { return AbstractDomainDummy(true); }
 
-    // Return whether the two values represent the same thing
+    // The same, for an instruction with two operands of the same integer type and an integer
+    // result. AbstractStateValueSet lowers those into an Operation once, and calls this on every
+    // visit, so it should not need to look at the instruction again.
+    static AbstractDomainDummy interpret (
+        Operation const& op, AbstractDomainDummy const& a, AbstractDomainDummy const& b
+    ) { return AbstractDomainDummy(true); }
+
+    // Return whether the two values represent the same thing. This may be called with values of
+    // different types (e.g. i8 and i32), those should just compare unequal.
     bool operator== (AbstractDomainDummy o) const
         { assert(false); return false; }
+
+    // Hash the value, such that equal values have the same hash. (This is found via argument
+    // dependent lookup, as the llvm::hash_value functions are.)
+    friend llvm::hash_code hash_value(AbstractDomainDummy const& value)
+        { return llvm::hash_code {0}; }
     
     // Refine a by using the information that the value has to fulfill the predicate w.r.t. b. For
     // example, if the domain is an interval domain:
@@ -59,6 +88,8 @@ public:
     // This mirrors the AbstractState::merge method (documented in AbstractStateDummy), so please
     // refer to that for a description of the different operations. Instead of modifying the object,
     // this returns a new one containing the result of the operation.
+    //  For UPPER_BOUND, WIDEN and WIDEN_TOP, merging bottom with b has to return b unchanged, as the
+    // states take over values they did not have before without calling this.
     static AbstractDomainDummy merge(Merge_op::Type op, AbstractDomainDummy a, AbstractDomainDummy b)
         { return AbstractDomainDummy(true); }
 };
@@ -67,108 +98,349 @@ public:
 // and unsigned, there is a 'u' or 's' prefix, so 'u<=' means 'unsigned lesser than or equal'.
 char const* get_predicate_name(llvm::CmpInst::Predicate pred);
 
+// Assigns a dense index to each SSA value of a function that AbstractStateValueSet keeps track of,
+// i.e. the arguments and all instructions producing a value. The fixpoint driver builds this once per
+// function, when collecting the basic blocks, so that the states can store their values in a flat
+// array instead of hashing llvm::Value pointers all the time.
+//  It also remembers for each incoming value of a phi node which of the predecessors of the block it
+// comes from, so that apply does not have to search for it on every visit. For the debug output,
+// it caches which values each block reads.
+class ValueNumbering {
+public:
+    explicit ValueNumbering(llvm::Function const& f);
+
+    // Returns the index of value, or -1 if it is not tracked (e.g. constants or globals)
+    int lookup(llvm::Value const& value) const {
+        auto it = ids.find(&value);
+        return it != ids.end() ? it->second : -1;
+    }
+
+    llvm::Value const* value(int id) const { return values[id]; }
+    int size() const { return values.size(); }
+
+    // Returns the position in llvm::predecessors of the block of incoming value i of the phi node
+    // with index phi_id
+    int phiPredecessor(int phi_id, unsigned i) const {
+        assert(phi_offsets[phi_id] != -1 /* not a phi node */);
+        return phi_preds[phi_offsets[phi_id] + i];
+    }
+
+    // Returns the indices of the values that are used in bb but not defined there, in increasing
+    // order. This is computed on the first call for each block, as only printIncoming needs it.
+    std::vector<int> const& readValues(llvm::BasicBlock const& bb) const;
+
+private:
+    std::vector<llvm::Value const*> values; // Maps indices back to their values
+    llvm::DenseMap<llvm::Value const*, int> ids;
+
+    // For each phi node, phi_offsets contains the position of its first incoming value in phi_preds
+    // (and -1 for other values). phi_preds contains the predecessor index of each incoming value.
+    std::vector<int> phi_offsets;
+    std::vector<int> phi_preds;
+
+    // The cache of readValues (an unordered_map, as references to its elements stay valid)
+    mutable std::unordered_map<llvm::BasicBlock const*, std::vector<int>> read_values;
+};
+
+// For -painpass-liveness, computes which values the state leaving each basic block has to keep.
+// These are the values live at the end of the block, the ones it defines (so that they still show up
+// in the results, for the entry block this includes the arguments), and the operands of the compare
+// its branch depends on. The latter count as used by the branch, as refining them to bottom tells us
+// that the successor cannot be reached.
+//  Everything else can be dropped, so that the states do not grow with the length of the function.
+class Liveness {
+public:
+    Liveness(llvm::Function const& f, ValueNumbering const& numbering);
+
+    // Returns the indices of the values a basic block keeps, in increasing order. The block is given
+    // by its position in the function, i.e. its id in ControlFlowGraph.
+    std::vector<int> const& keptValues(int block) const { return kept[block]; }
+
+private:
+    llvm::DenseMap<llvm::BasicBlock const*, int> blocks; // Maps the blocks to their position in f
+    std::vector<std::vector<int>> kept;
+};
+
+// Interns values of AbstractDomain, handing out a 32-bit handle for each distinct one. This way, the
+// states only have to store the handles, and equal values can be compared as integers. Handle 0 is
+// always bottom.
+//  Values are never removed. The states of a thread share one table (see AbstractStateValueSet),
+// which is cleared once none of them are left, i.e. after the driver is done with a function.
+template <typename AbstractDomain>
+class ValueInterner {
+public:
+    using Handle = std::uint32_t;
+    static constexpr Handle bottom = 0;
+
+    ValueInterner() { clear(); }
+
+    Handle intern(AbstractDomain const& value) {
+        if (2 * (values.size() + 1) > table.size()) grow();
+
+        std::size_t mask = table.size() - 1;
+        for (std::size_t i = hash_value(value) & mask; ; i = (i+1) & mask) {
+            if (table[i] == empty) {
+                table[i] = values.size();
+                values.push_back(value);
+                return table[i];
+            } else if (values[table[i]] == value) {
+                return table[i];
+            }
+        }
+    }
+
+    // The reference stays valid until the table is cleared
+    AbstractDomain const& get(Handle handle) const { return values[handle]; }
+
+    void clear() {
+        values.clear();
+        table.assign(16, empty);
+        intern(AbstractDomain {});
+    }
+
+private:
+    static constexpr Handle empty = -1;
+
+    void grow() {
+        std::size_t size = table.size() * 2;
+        table.assign(size, empty);
+        for (Handle handle = 0; handle < values.size(); ++handle) {
+            std::size_t i = hash_value(values[handle]) & (size-1);
+            while (table[i] != empty) i = (i+1) & (size-1);
+            table[i] = handle;
+        }
+    }
+
+    std::deque<AbstractDomain> values; // A deque, so that references to the values stay valid
+    std::vector<Handle> table; // Open addressing with linear probing, maps hashes to handles
+};
+
+template <typename AbstractDomain>
+constexpr typename ValueInterner<AbstractDomain>::Handle ValueInterner<AbstractDomain>::bottom;
+template <typename AbstractDomain>
+constexpr typename ValueInterner<AbstractDomain>::Handle ValueInterner<AbstractDomain>::empty;
+
 template <typename AbstractDomain>
 class AbstractStateValueSet {
 public:
-    std::unordered_map<llvm::Value const*, AbstractDomain> values;
+    // All states of a function share its numbering. A state that was default initialised (so it is
+    // bottom) does not have one yet, it picks it up the first time something is merged into it.
+    ValueNumbering const* numbering = nullptr;
+
+    // The values are indexed by their number and stored in fixed-size chunks. Copies of a state share
+    // their chunks, a chunk is only copied once one of the states modifies it. So branching on a
+    // copy only pays for the one or two chunks containing the refined values. A null chunk does not
+    // contain any values.
+    //  As there is a difference between a value being bottom and not being present at all, each
+    // chunk keeps track of the latter separately.
+    //  The chunks only store handles of the values, which are interned in a table shared by all
+    // states of the thread.
+    using Interner = ValueInterner<AbstractDomain>;
+    using Handle = typename Interner::Handle;
+    static constexpr int chunk_bits = 6;
+    static constexpr int chunk_size = 1 << chunk_bits;
+    struct Chunk {
+        std::uint64_t present = 0;
+        Handle values[chunk_size] = {};
+    };
+    std::vector<std::shared_ptr<Chunk>> chunks;
+
+    // Keeps track of the number of states on this thread, to clear the interned values once there
+    // are none left. Otherwise, the table would grow with each function that is analysed. The
+    // lowered basic blocks (see Program) go at the same time, as they refer to interned values.
+    struct InternerUse {
+        InternerUse() { ++count(); }
+        InternerUse(InternerUse const&) { ++count(); }
+        InternerUse& operator=(InternerUse const&) { return *this; }
+        ~InternerUse() {
+            if (--count() == 0) {
+                interner().clear();
+                programs().clear();
+            }
+        }
+
+        static int& count() { static thread_local int count = 0; return count; }
+    };
+    InternerUse interner_use;
+
+    // Each basic block is lowered once into a Program, which apply runs on every visit. It lists the
+    // instructions whose result is used as steps, with their operands in a flat array.
+    //  An operand is either a value of the numbering, or a constant (or value we do not track), in
+    // which case it directly contains the handle of its value. Instructions with two integer
+    // operands of the same type and an integer result are described by an Operation, so that
+    // AbstractDomain does not have to look at them again. The others keep using the llvm::Instruction.
+    struct Operand {
+        int id = -1; // The index of the value, or -1 to use handle
+        Handle handle = Interner::bottom;
+    };
+    struct Step {
+        enum Kind: char {
+            PHI, BINARY, OTHER
+        };
+        Kind kind;
+        int result; // The index of the value of the instruction
+        int first_operand; // The position of the first operand in Program::operands
+        int operand_count;
+        Operation op; // Only for BINARY
+        Handle range = Interner::bottom; // Only for PHI, the range of an induction variable (if known)
+        llvm::Instruction const* inst; // For OTHER, and the debug output
+    };
+    struct Program {
+        std::vector<Step> steps;
+        std::vector<Operand> operands;
+        Handle top;
+    };
 
     // We need an additional boolean, as there is a difference between an empty AbstractState and
     // one that is bottom.
     bool isBottom = true;
 
+    // The number of values that are present and bottom. If there are any, checkForBottom turns the
+    // whole state into bottom.
+    int bottom_count = 0;
+
 public:
     AbstractStateValueSet() = default;
     AbstractStateValueSet(AbstractStateValueSet const& state) = default;
 
-    explicit AbstractStateValueSet(llvm::Function const& f) {
+    AbstractStateValueSet(llvm::Function const& f, ValueNumbering const& numbering) {
+        setNumbering(numbering);
+        
         // We need to initialise the arguments to T
         for (llvm::Argument const& arg: f.args()) {
-            values[&arg] = AbstractDomain {true};
+            set(numbering.lookup(arg), AbstractDomain {true});
         }
         isBottom = false;
     }
 
     void apply(llvm::BasicBlock const& bb, std::vector<AbstractStateValueSet> const& pred_values) {
         if (isBottom) {
-            dbgs(3) << "    Basic block is unreachable, everything is bottom\n";
+            DBGS(3) << "    Basic block is unreachable, everything is bottom\n";
             return;
         }
-        
-        std::vector<AbstractDomain> operands;
 
-        // Go through each instruction of the basic block and apply it to the state
-        for (llvm::Instruction const& inst: bb) {
-            // If the result of the instruction is not used, there is no reason to compute
-            // it. (There are no side-effects in LLVM IR. (I hope.))
-            if (inst.use_empty()) continue;
+        Program const& program = compile(bb);
+        std::vector<AbstractDomain> operands; // Only used for OTHER
 
-            AbstractDomain inst_result;
-            
-            if (llvm::PHINode const* phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
-                // Phi nodes are handled here, to get the precise values of the predecessors
-                
-                for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
-                    // Find the predecessor corresponding to the block of the phi node
-                    unsigned block = 0;
-                    for (llvm::BasicBlock const* pred_bb: llvm::predecessors(&bb)) {
-                        if (pred_bb == phi->getIncomingBlock(i)) break;
-                        ++block;
-                    }
+        // Returns operand i of step. For phi nodes, this is the value leaving the corresponding
+        // predecessor, to get the precise values of the predecessors.
+        auto operand = [&](Step const& step, int i) -> AbstractDomain const& {
+            AbstractStateValueSet const& state = step.kind == Step::PHI
+                ? pred_values[numbering->phiPredecessor(step.result, i)] : *this;
+            return interner().get(state.operandHandle(program.operands[step.first_operand + i], program.top));
+        };
 
-                    // Take the union of the values
-                    AbstractDomain pred_value = pred_values[block].getAbstractValue(*phi->getIncomingValue(i));
-                    inst_result = AbstractDomain::merge(Merge_op::UPPER_BOUND, inst_result, pred_value);
+        // Go through each (used) instruction of the basic block and apply it to the state
+        for (Step const& step: program.steps) {
+            AbstractDomain inst_result;
 
-                    operands.push_back(pred_value); // Keep the debug output happy
+            if (step.kind == Step::PHI and step.range != Interner::bottom) {
+                // An induction variable, we already know all values it takes
+                inst_result = interner().get(step.range);
+            } else if (step.kind == Step::PHI) {
+                // Take the union of the values
+                for (int i = 0; i < step.operand_count; ++i) {
+                    inst_result = AbstractDomain::merge(Merge_op::UPPER_BOUND, inst_result, operand(step, i));
                 }
+            } else if (step.kind == Step::BINARY) {
+                inst_result = AbstractDomain::interpret(step.op, operand(step, 0), operand(step, 1));
+                ++counters.transfer_calls;
             } else {
-                for (llvm::Value const* value: inst.operand_values()) {
-                    operands.push_back(getAbstractValue(*value));
-                }
-
-                // Compute the result of the operation
-                inst_result = AbstractDomain::interpret(inst, operands);
+                for (int i = 0; i < step.operand_count; ++i) operands.push_back(operand(step, i));
+                inst_result = AbstractDomain::interpret(*step.inst, operands);
+                ++counters.transfer_calls;
+                operands.clear();
             }
-            
-            values[&inst] = inst_result;
 
-            dbgs(3).indent(2) << inst << " // " << values.at(&inst) << ", args ";
-            {int i = 0;
-            for (llvm::Value const* value: inst.operand_values()) {
-                if (i) dbgs(3) << ", ";
-                if (value->getName().size()) dbgs(3) << '%' << value->getName() << " = ";
-                dbgs(3) << operands[i];
-                ++i;
-            }}
-            dbgs(3) << '\n';
-
-            operands.clear();
+            set(step.result, inst_result);
+
+            if (debugEnabled(3)) {
+                dbgs(3).indent(2) << *step.inst << " // " << get(step.result) << ", args ";
+                int i = 0;
+                for (llvm::Value const* value: step.inst->operand_values()) {
+                    if (i) dbgs(3) << ", ";
+                    if (value->getName().size()) dbgs(3) << '%' << value->getName() << " = ";
+                    dbgs(3) << operand(step, i);
+                    ++i;
+                }
+                dbgs(3) << '\n';
+            }
         }
     }
     
-    bool merge(Merge_op::Type op, AbstractStateValueSet const& other) {
+    // If changes is given, the indices of the values that changed are appended to it.
+    bool merge(Merge_op::Type op, AbstractStateValueSet const& other, std::vector<int>* changes = nullptr) {
         bool changed = false;
 
         if (isBottom > other.isBottom) {
             changed = true;
             isBottom = false;
         }
+
+        // The other state has never seen any values, so there is nothing to merge
+        if (not other.numbering) return changed;
         
-        for (std::pair<llvm::Value const*, AbstractDomain> i: other.values) {
-            // If our value did not exist before, it will be implicitly initialised as bottom,
-            // which works just fine.
-            AbstractDomain v = AbstractDomain::merge(op, values[i.first], i.second);
-
-            // No change, nothing to do here
-            if (v == values[i.first]) continue;
-
-            if (i.first->getName().size())
-                dbgs(3) << "    %" << i.first->getName() << " set to " << v << ", " << Merge_op::name[op] << " "
-                        << values[i.first] << " and " << i.second << '\n';
-                
-            values[i.first] = v;
-            changed = true;
+        if (not numbering) setNumbering(*other.numbering);
+        assert(numbering == other.numbering /* states of different functions are merged */);
+        
+        for (int c = 0; c < (int)chunks.size(); ++c) {
+            // Chunks that are shared cannot contain anything new. This does not hold for widening, see
+            // below.
+            Chunk const* theirs = other.chunks[c].get();
+            if (not theirs or (other.chunks[c] == chunks[c] and op != Merge_op::WIDEN)) continue;
+
+            // If we have none of these values, an upper bound is just theirs, so we can share it. This
+            // relies on merge(op, bottom, x) == x for every op but NARROW (see AbstractDomainDummy).
+            if (not chunks[c] and op != Merge_op::NARROW) {
+                chunks[c] = other.chunks[c];
+                for (std::uint64_t bits = theirs->present; bits; bits &= bits - 1) {
+                    int id = c << chunk_bits | llvm::countTrailingZeros(bits);
+                    if (theirs->values[id & (chunk_size-1)] == Interner::bottom) {
+                        ++bottom_count;
+                        continue;
+                    }
 
+                    llvm::Value const* value = numbering->value(id);
+                    if (value->getName().size())
+                        DBGS(3) << "    %" << value->getName() << " set to " << get(id) << ", " << Merge_op::name[op]
+                                << ' ' << AbstractDomain {} << " and " << get(id) << '\n';
+                    changed = true;
+                    if (changes) changes->push_back(id);
+                }
+                continue;
+            }
+
+            // Only look at the values they actually have
+            for (std::uint64_t bits = theirs->present; bits; bits &= bits - 1) {
+                int id = c << chunk_bits | llvm::countTrailingZeros(bits);
+                Handle their_handle = theirs->values[id & (chunk_size-1)];
+                bool was_present = has(id);
+                Handle our_handle = was_present ? handle(id) : Interner::bottom;
+
+                // The upper bound or narrowing of a value with itself does not change it. (Widening
+                // might, e.g. SimpleInterval goes to top for large intervals.)
+                if (was_present and our_handle == their_handle and op != Merge_op::WIDEN) continue;
+
+                // If our value did not exist before, it is treated as bottom, which works just fine.
+                AbstractDomain const& ours = interner().get(our_handle);
+                AbstractDomain const& their_value = interner().get(their_handle);
+                AbstractDomain v = AbstractDomain::merge(op, ours, their_value);
+                Handle v_handle = interner().intern(v);
+
+                // No change, nothing to do here
+                if (was_present and v_handle == our_handle) continue;
+
+                llvm::Value const* value = numbering->value(id);
+                if (value->getName().size())
+                    DBGS(3) << "    %" << value->getName() << " set to " << v << ", " << Merge_op::name[op] << " "
+                            << ours << " and " << their_value << '\n';
+
+                setHandle(id, v_handle);
+                if (was_present or v_handle != Interner::bottom) {
+                    changed = true;
+                    if (changes) changes->push_back(id);
+                }
+            }
         }
 
         if (changed) checkForBottom(4);
@@ -206,53 +478,60 @@ public:
             pred = cmp->getInversePredicate();
         } else {
             assert(false /* we were not passed the right 'from' block? */);
+            return;
         }
         llvm::CmpInst::Predicate pred_s = llvm::CmpInst::getSwappedPredicate(pred);
 
-        dbgs(3) << "      Detected branch from " << from.getName() << " towards " << towards.getName()
+        DBGS(3) << "      Detected branch from " << from.getName() << " towards " << towards.getName()
                 << " using compare in %" << cmp->getName() << '\n';
         
         llvm::Value const& lhs = *cmp->getOperand(0);
         llvm::Value const& rhs = *cmp->getOperand(1);
+        int lhs_id = indexOf(lhs);
+        int rhs_id = indexOf(rhs);
 
         AbstractDomain lhs_new;
         AbstractDomain rhs_new;
         
         // Constrain the values if they exist.
-        if (values.count(&lhs)) {
-            dbgs(3) << "      Deriving constraint %" << lhs.getName()  << ' ' << get_predicate_name(pred) << ' ';
-            (rhs.getName().size() ? dbgs(3) << "%" << rhs.getName() : dbgs(3) << rhs)
-                    << ", with %" << lhs.getName() << " = " << values[&lhs];
-            if (values.count(&rhs)) dbgs(3) << " and %" << rhs.getName() << " = " << values[&rhs];
-            dbgs(3) << '\n';
+        if (lhs_id != -1) {
+            if (debugEnabled(3)) {
+                dbgs(3) << "      Deriving constraint %" << lhs.getName()  << ' ' << get_predicate_name(pred) << ' ';
+                (rhs.getName().size() ? dbgs(3) << "%" << rhs.getName() : dbgs(3) << rhs)
+                        << ", with %" << lhs.getName() << " = " << get(lhs_id);
+                if (rhs_id != -1) dbgs(3) << " and %" << rhs.getName() << " = " << get(rhs_id);
+                dbgs(3) << '\n';
+            }
 
             // For the lhs we say that 'lhs pred rhs' has to hold
-            lhs_new = AbstractDomain::refineBranch(pred, lhs, rhs, values[&lhs], getAbstractValue(rhs));
+            lhs_new = AbstractDomain::refineBranch(pred, lhs, rhs, get(lhs_id), getAbstractValue(rhs));
         }
-        if (values.count(&rhs)) {
-            dbgs(3) << "      Deriving constraint %" << rhs.getName() << ' ' << get_predicate_name(pred_s) << ' ';
-            (lhs.getName().size() ? dbgs(3) << "%" << lhs.getName() : dbgs(3) << lhs)
-                    << ", with %" << rhs.getName() << " = " << values[&rhs];
-            if (values.count(&lhs)) dbgs(3) << " and %" << lhs.getName() << " = " << values[&lhs];
-            dbgs(3) << '\n';
+        if (rhs_id != -1) {
+            if (debugEnabled(3)) {
+                dbgs(3) << "      Deriving constraint %" << rhs.getName() << ' ' << get_predicate_name(pred_s) << ' ';
+                (lhs.getName().size() ? dbgs(3) << "%" << lhs.getName() : dbgs(3) << lhs)
+                        << ", with %" << rhs.getName() << " = " << get(rhs_id);
+                if (lhs_id != -1) dbgs(3) << " and %" << lhs.getName() << " = " << get(lhs_id);
+                dbgs(3) << '\n';
+            }
 
             // Here, we take the swapped predicate and assert 'rhs pred_s lhs'
-            rhs_new = AbstractDomain::refineBranch(pred_s, rhs, lhs, values[&rhs], getAbstractValue(lhs));
+            rhs_new = AbstractDomain::refineBranch(pred_s, rhs, lhs, get(rhs_id), getAbstractValue(lhs));
         }
 
         // The control flow is like this so that the previous ifs do not conflict with one another.
-        if (values.count(&lhs)) values[&lhs] = lhs_new;
-        if (values.count(&rhs)) values[&rhs] = rhs_new;
+        if (lhs_id != -1) set(lhs_id, lhs_new);
+        if (rhs_id != -1) set(rhs_id, rhs_new);
         
-        if (values.count(&lhs) && values.count(&rhs)) {
-            dbgs(3) << "      Values restricted to %" << lhs.getName() << " = " << values[&lhs] << " and %"
-                    << rhs.getName() << " = " << values[&rhs] << '\n';
-        } else if (values.count(&lhs)) {
-            dbgs(3) << "      Value restricted to %" << lhs.getName() << " = " << values[&lhs]  << '\n';
-        } else if (values.count(&rhs)) {
-            dbgs(3) << "      Value restricted to %" << rhs.getName() << " = " << values[&rhs]  << '\n';
+        if (lhs_id != -1 && rhs_id != -1) {
+            DBGS(3) << "      Values restricted to %" << lhs.getName() << " = " << get(lhs_id) << " and %"
+                    << rhs.getName() << " = " << get(rhs_id) << '\n';
+        } else if (lhs_id != -1) {
+            DBGS(3) << "      Value restricted to %" << lhs.getName() << " = " << get(lhs_id)  << '\n';
+        } else if (rhs_id != -1) {
+            DBGS(3) << "      Value restricted to %" << rhs.getName() << " = " << get(rhs_id)  << '\n';
         } else {
-            dbgs(3) << "      No restrictions were derived.\n";
+            DBGS(3) << "      No restrictions were derived.\n";
         }
 
         // This cannot happen when doing UPPER_BOUND or WIDEN, but for NARROW it is possible, so
@@ -260,21 +539,35 @@ public:
         checkForBottom(6);
     }
 
-    void printIncoming(llvm::BasicBlock const& bb, llvm::raw_ostream& out, int indentation = 0) const {
-        // @Speed: This is quadratic, could be linear
-        bool nothing = true;
-        for (std::pair<llvm::Value const*, AbstractDomain> const& i: values) {
-            bool read    = false;
-            bool written = false;
-            for (llvm::Instruction const& inst: bb) {
-                if (&inst == i.first) written = true;
-                for (llvm::Value const* v: inst.operand_values()) {
-                    if (v == i.first) read = true;
-                }
+    // Drops all values except the ones with the given indices, which have to be in increasing order
+    void keepOnly(std::vector<int> const& ids) {
+        // A value that is bottom still makes the whole state bottom, even if we would drop it
+        if (checkForBottom(4)) return;
+
+        auto it = ids.begin();
+        for (int c = 0; c < (int)chunks.size(); ++c) {
+            std::uint64_t mask = 0;
+            for (; it != ids.end() and *it >> chunk_bits == c; ++it) {
+                mask |= (std::uint64_t)1 << (*it & (chunk_size-1));
+            }
+            if (not chunks[c] or (chunks[c]->present & ~mask) == 0) continue;
+
+            if ((chunks[c]->present & mask) == 0) {
+                chunks[c] = nullptr;
+            } else {
+                if (chunks[c].use_count() > 1) chunks[c] = std::make_shared<Chunk>(*chunks[c]);
+                chunks[c]->present &= mask;
             }
+        }
+    }
 
-            if (read and not written) {
-                out.indent(indentation) << '%' << i.first->getName() << " = " << i.second << '\n';
+    void printIncoming(llvm::BasicBlock const& bb, llvm::raw_ostream& out, int indentation = 0) const {
+        // Only the values read by the block are relevant
+        bool nothing = true;
+        if (numbering) {
+            for (int id: numbering->readValues(bb)) {
+                if (not has(id)) continue;
+                out.indent(indentation) << '%' << numbering->value(id)->getName() << " = " << get(id) << '\n';
                 nothing = false;
             }
         }
@@ -283,20 +576,47 @@ public:
         }
     }
     void printOutgoing(llvm::BasicBlock const& bb, llvm::raw_ostream& out, int indentation = 0) const {
-        for (auto const& i: values) {
-            out.indent(indentation) << '%' << i.first->getName() << " = " << i.second << '\n';
+        bool nothing = true;
+        for (int id = 0; id < size(); ++id) {
+            if (not has(id)) continue;
+            out.indent(indentation) << '%' << numbering->value(id)->getName() << " = " << get(id) << '\n';
+            nothing = false;
         }
-        if (values.size() == 0) {
+        if (nothing) {
             out.indent(indentation) << "<nothing>\n";
         }
     };
+
+    // Outputs a line of JSON with the values defined in bb, and those that differ from the state of
+    // the block defining them. (defining contains that state for each value in the numbering.)
+    void printOutgoingJson(
+        llvm::BasicBlock const& bb, llvm::raw_ostream& out,
+        std::vector<AbstractStateValueSet const*> const& defining, ValueNames& names
+    ) const {
+        names.printBlockStart(out, bb);
+        bool first = true;
+        for (int c = 0; c < (int)chunks.size(); ++c) {
+            if (not chunks[c]) continue;
+            for (std::uint64_t bits = chunks[c]->present; bits; bits &= bits - 1) {
+                int id = c << chunk_bits | llvm::countTrailingZeros(bits);
+                AbstractStateValueSet const* def = defining[id];
+                if (def != this and def->has(id) and def->handle(id) == handle(id)) continue;
+
+                names.printValue(out, *numbering->value(id), get(id), first);
+                first = false;
+            }
+        }
+        out << "}}\n";
+    }
     
 public:
     AbstractDomain getAbstractValue(llvm::Value const& value) const {
         if (llvm::Constant const* c = llvm::dyn_cast<llvm::Constant>(&value)) {
             return AbstractDomain {*c};
-        } else if (values.count(&value)) {
-            return values.at(&value);
+        }
+        int id = indexOf(value);
+        if (id != -1) {
+            return get(id);
         } else if (isBottom) {
             // If we are at bottom, there are no values
             return AbstractDomain {};
@@ -306,22 +626,147 @@ public:
         }
     }
 
+    // Returns the index of value, if we currently have a value for it, and -1 otherwise
+    int indexOf(llvm::Value const& value) const {
+        if (not numbering) return -1;
+        int id = numbering->lookup(value);
+        return id != -1 and has(id) ? id : -1;
+    }
+
     // If any of our values is bottom, then we are bottom as well. So this function checks that and
     // normalises our value. Returns whether this changed our value (i.e. we are now bottom).
+    //  The number of values that are bottom is kept up to date by set, so this does not need to look
+    // at the values (except to print which one it was).
     bool checkForBottom(int indent = 0) {
-        if (isBottom) return false;
-
-        for (auto const& i: values) {
-            if (i.second == AbstractDomain {}) {
-                dbgs(3).indent(indent) << "Variable %" << i.first->getName() << " is bottom, so the state is as well.\n";
-                
-                values.clear();
-                isBottom = true;
-                
-                return true;
+        if (isBottom or not bottom_count) return false;
+
+        if (debugEnabled(3)) {
+            for (int id = 0; id < size(); ++id) {
+                if (not has(id) or handle(id) != Interner::bottom) continue;
+                dbgs(3).indent(indent) << "Variable %" << numbering->value(id)->getName() << " is bottom, so the state is as well.\n";
+                break;
+            }
+        }
+
+        chunks.assign(chunks.size(), nullptr);
+        bottom_count = 0;
+        isBottom = true;
+        return true;
+    }
+
+    int size() const { return numbering ? numbering->size() : 0; }
+    int valueCount() const {
+        int count = 0;
+        for (auto const& chunk: chunks) {
+            if (chunk) count += llvm::countPopulation(chunk->present);
+        }
+        return count;
+    }
+    bool has(int id) const {
+        Chunk const* chunk = chunks[id >> chunk_bits].get();
+        return chunk and chunk->present >> (id & (chunk_size-1)) & 1;
+    }
+    AbstractDomain const& get(int id) const {
+        return interner().get(handle(id));
+    }
+    Handle handle(int id) const {
+        assert(has(id));
+        return chunks[id >> chunk_bits]->values[id & (chunk_size-1)];
+    }
+
+    static Interner& interner() {
+        static thread_local Interner interner;
+        return interner;
+    }
+
+private:
+    // The programs of the basic blocks that were lowered on this thread
+    static std::unordered_map<llvm::BasicBlock const*, Program>& programs() {
+        static thread_local std::unordered_map<llvm::BasicBlock const*, Program> programs;
+        return programs;
+    }
+
+    // Returns the Program for bb, lowering it on the first call
+    Program const& compile(llvm::BasicBlock const& bb) const {
+        auto it = programs().find(&bb);
+        if (it != programs().end()) return it->second;
+
+        Program& program = programs()[&bb];
+        program.top = interner().intern(AbstractDomain {true});
+        for (llvm::Instruction const& inst: bb) {
+            // If the result of the instruction is not used, there is no reason to compute
+            // it. (There are no side-effects in LLVM IR. (I hope.))
+            if (inst.use_empty()) continue;
+
+            Step step;
+            step.result = numbering->lookup(inst);
+            step.first_operand = program.operands.size();
+            step.inst = &inst;
+            for (llvm::Value const* value: inst.operand_values()) {
+                Operand operand;
+                if (llvm::Constant const* c = llvm::dyn_cast<llvm::Constant>(value)) {
+                    operand.handle = interner().intern(AbstractDomain {*c});
+                } else {
+                    // This is top if the value is not tracked, as in getAbstractValue
+                    operand.id = numbering->lookup(*value);
+                    operand.handle = program.top;
+                }
+                program.operands.push_back(operand);
+            }
+            step.operand_count = program.operands.size() - step.first_operand;
+
+            llvm::Type const* type = step.operand_count ? inst.getOperand(0)->getType() : nullptr;
+            if (llvm::PHINode const* phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+                step.kind = Step::PHI;
+                llvm::ConstantRange const* range = induction_ranges ? induction_ranges->lookup(*phi) : nullptr;
+                if (range) step.range = interner().intern(AbstractDomain {*range});
+            } else if (step.operand_count == 2 and inst.getType()->isIntegerTy() and type->isIntegerTy()
+                    and inst.getOperand(1)->getType() == type) {
+                step.kind = Step::BINARY;
+                step.op = Operation {inst, type->getIntegerBitWidth()};
+            } else {
+                step.kind = Step::OTHER;
             }
+            program.steps.push_back(step);
         }
-        return false;
+        return program;
+    }
+
+    // Returns the handle of the value of operand in this state
+    Handle operandHandle(Operand const& operand, Handle top) const {
+        if (operand.id == -1) return operand.handle;
+        if (numbering and has(operand.id)) return handle(operand.id);
+
+        // If we are at bottom, there are no values
+        return isBottom ? Interner::bottom : top;
+    }
+
+    void setNumbering(ValueNumbering const& numbering_) {
+        numbering = &numbering_;
+        chunks.resize((numbering->size() + chunk_size-1) >> chunk_bits);
+    }
+
+    void set(int id, AbstractDomain const& value) {
+        setHandle(id, interner().intern(value));
+    }
+
+    void setHandle(int id, Handle value) {
+        assert(id != -1 /* value is not part of the numbering */);
+        std::shared_ptr<Chunk>& chunk = chunks[id >> chunk_bits];
+        if (not chunk) {
+            chunk = std::make_shared<Chunk>();
+        } else if (chunk.use_count() > 1) {
+            // Someone else is still looking at this chunk, so we need our own copy
+            chunk = std::make_shared<Chunk>(*chunk);
+        }
+
+        std::uint64_t bit = (std::uint64_t)1 << (id & (chunk_size-1));
+        Handle& slot = chunk->values[id & (chunk_size-1)];
+        if (chunk->present & bit and slot == Interner::bottom) --bottom_count;
+        if (value == Interner::bottom) ++bottom_count;
+
+        slot = value;
+        chunk->present |= bit;
     }
 };
 
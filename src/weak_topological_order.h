@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "control_flow_graph.h"
+
+namespace pcpo {
+
+// A weak topological ordering of the basic blocks of a function, as described by Bourdoncle in
+// "Efficient chaotic iteration strategies with widenings" (1993). This is a hierarchical ordering,
+// where the blocks of each loop form a component, which starts with its head. Components may be
+// nested, e.g. the ordering
+//     entry (for.cond for.body (for.cond1 for.body3 for.inc) for.end for.inc6) for.end8
+// has the inner loop starting at for.cond1 nested in the outer one starting at for.cond. Every cycle
+// in the control flow graph passes through the head of some component, so these are the places
+// where we need to widen.
+//  The ordering is computed once, using a depth-first search starting at the entry block. The blocks
+// are identified by their ids in cfg. BlockT is either llvm::BasicBlock or llvm::BasicBlock const,
+// depending on which one the driver uses.
+template <typename BlockT>
+class WeakTopologicalOrder {
+public:
+    struct Element {
+        int id; // The id of the block in cfg
+        bool is_component; // Whether the block is the head of a component
+        std::vector<Element> body; // The rest of the component, in order
+
+        Element(int id, bool is_component = false): id{id}, is_component{is_component} {}
+    };
+
+    explicit WeakTopologicalOrder(ControlFlowGraph<BlockT> const& cfg): cfg{cfg}, dfn(cfg.size()) {
+        visit(0, -1);
+        std::reverse(elements.begin(), elements.end());
+    }
+
+    std::vector<Element> const& getElements() const { return elements; }
+
+    // Calls f for the ids of the heads of all components, including the nested ones
+    template <typename Func>
+    void forEachHead(Func f) const { forEachHead(elements, f); }
+
+    // Outputs the ordering in the notation used above
+    void print(llvm::raw_ostream& out) const { print(elements, out); }
+
+private:
+    ControlFlowGraph<BlockT> const& cfg;
+    std::vector<Element> elements;
+
+    // Depth-first numbering of the blocks. Blocks that are completely processed are set to INT_MAX.
+    std::vector<int> dfn;
+    std::vector<int> stack;
+    int num = 0;
+
+    // A pending call of visit in the algorithm of the paper. Once all successors are done, a block
+    // that turns out to be the head of a component is visited again to collect the component, which
+    // the paper does in a separate (mutually recursive) function.
+    struct Frame {
+        int bb;
+        int partition; // The frame whose component this adds to, or -1 for elements
+        int head;
+        bool loop = false;
+        bool in_component = false;
+        int next_succ = 0;
+        Element component;
+
+        Frame(int bb, int partition, int head): bb{bb}, partition{partition}, head{head}, component{bb, true} {}
+    };
+    std::vector<Frame> frames;
+
+    std::vector<Element>& partition(int frame) {
+        return frame == -1 ? elements : frames[frame].component.body;
+    }
+
+    void push(int bb, int partition) {
+        stack.push_back(bb);
+        dfn[bb] = ++num;
+        frames.emplace_back(bb, partition, num);
+    }
+
+    // This is the algorithm from the paper, with the recursion replaced by an explicit stack of frames,
+    // as the search goes as deep as the longest path through the function. Elements are added to the
+    // end of their partition, so it needs to be reversed once it is complete.
+    void visit(int bb, int partition_of_bb) {
+        push(bb, partition_of_bb);
+        while (frames.size()) {
+            int current = frames.size() - 1;
+            Frame& f = frames.back();
+            llvm::ArrayRef<int> succs = cfg.successors(f.bb);
+
+            if (f.next_succ < (int)succs.size()) {
+                int succ = succs[f.next_succ++];
+                if (dfn[succ] == 0) {
+                    // The result is taken into account once the frame of succ is done, see below
+                    push(succ, f.in_component ? current : f.partition);
+                } else if (not f.in_component and dfn[succ] <= f.head) {
+                    f.head = dfn[succ];
+                    f.loop = true;
+                }
+                continue;
+            }
+
+            if (not f.in_component and f.head == dfn[f.bb]) {
+                dfn[f.bb] = INT_MAX;
+                int element = stack.back();
+                stack.pop_back();
+                if (f.loop) {
+                    while (element != f.bb) {
+                        dfn[element] = 0;
+                        element = stack.back();
+                        stack.pop_back();
+                    }
+                    f.in_component = true;
+                    f.next_succ = 0;
+                    continue;
+                }
+                partition(f.partition).emplace_back(f.bb);
+            } else if (f.in_component) {
+                std::reverse(f.component.body.begin(), f.component.body.end());
+                partition(f.partition).push_back(std::move(f.component));
+            }
+
+            int head = f.head;
+            frames.pop_back();
+            if (frames.size() and not frames.back().in_component and head <= frames.back().head) {
+                frames.back().head = head;
+                frames.back().loop = true;
+            }
+        }
+    }
+
+    template <typename Func>
+    static void forEachHead(std::vector<Element> const& partition, Func& f) {
+        for (Element const& i: partition) {
+            if (not i.is_component) continue;
+            f(i.id);
+            forEachHead(i.body, f);
+        }
+    }
+
+    void print(std::vector<Element> const& partition, llvm::raw_ostream& out) const {
+        bool first = true;
+        for (Element const& i: partition) {
+            if (not first) out << ' ';
+            first = false;
+            if (i.is_component) {
+                out << '(' << cfg.block(i.id)->getName();
+                if (i.body.size()) out << ' ';
+                print(i.body, out);
+                out << ')';
+            } else {
+                out << cfg.block(i.id)->getName();
+            }
+        }
+    }
+};
+
+} /* end of namespace pcpo */
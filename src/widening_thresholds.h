@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "llvm/ADT/APInt.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+namespace pcpo {
+
+// The constants of a function that widening should stop at, before growing a value any further.
+// These are the constants integers are compared against, and the constant incoming values of phi
+// nodes, which are usually where loops start. So for a simple counting loop, widening jumps right to
+// its bound.
+//  Growing upwards, we also stop one after each compared constant, and growing downwards one before
+// it, as that is where the counter of a loop ends up: i < 1000 exits at 1000 and i <= 1000 at 1001,
+// while i > 0 exits at 0 and i >= 0 at -1. (The constant one below would only make the counter of
+// i < 1000 stop at 999 first.)
+//  The widening and sparse drivers collect these once, while registering the basic blocks of the
+// function, and set widening_thresholds while they run (unless disabled by -painpass-thresholds).
+// AbstractDomain::merge may then use them for Merge_op::WIDEN.
+class WideningThresholds {
+public:
+    explicit WideningThresholds(llvm::Function const& f) {
+        for (llvm::BasicBlock const& bb: f) {
+            for (llvm::Instruction const& inst: bb) {
+                if (llvm::isa<llvm::ICmpInst>(inst)) {
+                    for (llvm::Value const* operand: inst.operand_values()) {
+                        llvm::ConstantInt const* c = llvm::dyn_cast<llvm::ConstantInt>(operand);
+                        if (c) addCompared(c->getValue());
+                    }
+                } else if (llvm::PHINode const* phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+                    for (llvm::Value const* incoming: phi->incoming_values()) {
+                        llvm::ConstantInt const* c = llvm::dyn_cast<llvm::ConstantInt>(incoming);
+                        if (c) addStart(c->getValue());
+                    }
+                }
+            }
+        }
+
+        sortValues();
+    }
+
+    // The same, for the given constants instead of the ones of a function, e.g. for testing
+    WideningThresholds(llvm::ArrayRef<llvm::APInt> compared, llvm::ArrayRef<llvm::APInt> starts) {
+        for (llvm::APInt const& i: compared) addCompared(i);
+        for (llvm::APInt const& i: starts) addStart(i);
+        sortValues();
+    }
+
+    // Returns the thresholds with the given bit width for growing upwards or downwards, sorted as
+    // unsigned numbers
+    llvm::ArrayRef<llvm::APInt> get(unsigned bit_width, bool up) const {
+        llvm::DenseMap<unsigned, std::vector<llvm::APInt>> const& thresholds = up ? upper : lower;
+        auto it = thresholds.find(bit_width);
+        return it != thresholds.end() ? llvm::ArrayRef<llvm::APInt> {it->second} : llvm::ArrayRef<llvm::APInt> {};
+    }
+
+    static bool ult(llvm::APInt const& a, llvm::APInt const& b) { return a.ult(b); }
+
+private:
+    void addCompared(llvm::APInt const& value) {
+        upper[value.getBitWidth()].push_back(value);
+        upper[value.getBitWidth()].push_back(value + 1);
+        lower[value.getBitWidth()].push_back(value);
+        lower[value.getBitWidth()].push_back(value - 1);
+    }
+    void addStart(llvm::APInt const& value) {
+        upper[value.getBitWidth()].push_back(value);
+        lower[value.getBitWidth()].push_back(value);
+    }
+
+    void sortValues() {
+        for (auto* thresholds: {&upper, &lower}) {
+            for (auto& i: *thresholds) {
+                std::vector<llvm::APInt>& values = i.second;
+                std::sort(values.begin(), values.end(), ult);
+                values.erase(std::unique(values.begin(), values.end()), values.end());
+            }
+        }
+    }
+
+    llvm::DenseMap<unsigned, std::vector<llvm::APInt>> upper; // Used when growing upwards
+    llvm::DenseMap<unsigned, std::vector<llvm::APInt>> lower; // Used when growing downwards
+};
+
+// The thresholds of the function the current thread analyses, or null if there are none
+extern thread_local WideningThresholds const* widening_thresholds;
+
+} /* end of namespace pcpo */
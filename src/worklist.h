@@ -0,0 +1,60 @@
+#pragma once
+
+#include <climits>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "global.h"
+
+namespace pcpo {
+
+// The worklist of the fixpoint drivers, containing the ids of the nodes that need to be
+// processed. Depending on the scheduling, it either returns the node pushed last (LIFO), or the one
+// with the lowest priority (RPO). The drivers use the position of the node in the reverse post-order
+// of its function as priority, so that the header of a loop is stabilised before its body.
+//  This does not check for duplicates, the drivers already keep track of which nodes are scheduled.
+class Worklist {
+public:
+    explicit Worklist(Scheduling::Type scheduling): scheduling{scheduling} {
+        assert(scheduling == Scheduling::LIFO or scheduling == Scheduling::RPO);
+    }
+
+    // Set the priority of a node. Nodes without one come last.
+    void setPriority(int node, int priority) {
+        if (node >= (int)priorities.size()) priorities.resize(node + 1, INT_MAX);
+        priorities[node] = priority;
+    }
+
+    void push(int node) {
+        if (scheduling == Scheduling::LIFO) {
+            stack.push_back(node);
+        } else {
+            queue.emplace(node < (int)priorities.size() ? priorities[node] : INT_MAX, node);
+        }
+    }
+
+    int pop() {
+        int node;
+        if (scheduling == Scheduling::LIFO) {
+            node = stack.back();
+            stack.pop_back();
+        } else {
+            node = queue.top().second;
+            queue.pop();
+        }
+        return node;
+    }
+
+    bool empty() const { return stack.empty() and queue.empty(); }
+    int size() const { return stack.size() + queue.size(); }
+
+private:
+    Scheduling::Type scheduling;
+    std::vector<int> priorities; // Indexed by node id
+    std::vector<int> stack; // Used for LIFO
+    std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> queue;
+};
+
+} /* end of namespace pcpo */
@@ -0,0 +1,134 @@
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "simple_interval.h"
+#include "xorshift.h"
+
+namespace pcpo {
+
+// Random inputs for the benchmark, in the internal representation (see _makeTopInterval) that the
+// _* operations expect.
+struct BenchInputs {
+    std::vector<SimpleInterval> a, b;
+};
+
+// Generates a random value of width w. Wider values are built from multiple calls to rand64.
+llvm::APInt randAPInt(u32 w) {
+    std::vector<u64> words;
+    for (u32 i = 0; i < w; i += 64) words.push_back(rand64());
+    return llvm::APInt {w, words};
+}
+
+// Generates count pairs of intervals of width w, with the same distribution as in
+// testSimpleDomain. Intervals are never bottom, but about 1/128 of them are top.
+BenchInputs generateInputs(u32 w, int count) {
+    BenchInputs inputs;
+    for (int i = 0; i < count; ++i) {
+        SimpleInterval x[2];
+        for (SimpleInterval& j: x) {
+            llvm::APInt beg = randAPInt(w);
+            llvm::APInt end = randAPInt(w);
+
+            // Ensure that the interval is not accidentally top
+            if (beg == end + 1) ++end;
+
+            j = (rand64() & 0x7f) ? SimpleInterval {beg, end} : SimpleInterval {true};
+            j = j._makeTopInterval(w);
+        }
+        inputs.a.push_back(x[0]);
+        inputs.b.push_back(x[1]);
+    }
+    return inputs;
+}
+
+// Calls op(a, b) for all the input pairs, until at least min_seconds have passed. Returns the time
+// per call in nanoseconds.
+template <typename Op>
+double measure(BenchInputs const& inputs, double min_seconds, Op op) {
+    using Clock = std::chrono::steady_clock;
+
+    // Keep the compiler from removing the calls
+    static volatile int sink;
+    int sum = 0;
+
+    long calls = 0;
+    auto time_start = Clock::now();
+    std::chrono::duration<double> time {0};
+    while (time.count() < min_seconds) {
+        for (size_t i = 0; i < inputs.a.size(); ++i) {
+            sum += op(inputs.a[i], inputs.b[i]).state;
+        }
+        calls += inputs.a.size();
+        time = Clock::now() - time_start;
+    }
+    sink = sum;
+
+    return time.count() * 1e9 / calls;
+}
+
+} // end of namespace pcpo
+
+
+int main(int argc, char** argv) {
+    using namespace pcpo;
+    using Predicate = llvm::CmpInst::Predicate;
+
+    // The time spent on each measurement can be passed as the first argument, in seconds
+    double min_seconds = argc > 1 ? std::atof(argv[1]) : 0.2;
+    constexpr int input_count = 1024;
+    u32 widths[] = {1, 8, 32, 64, 128};
+
+    // All of these get the same inputs, so the times can be compared between operations as well.
+    // The predicates of _refineBranch are cycled through.
+    struct Operation {
+        char const* name;
+        SimpleInterval (*op)(SimpleInterval const&, SimpleInterval const&);
+    };
+    static int pred_index;
+    Operation operations[] = {
+        {"_Add",          [](SimpleInterval const& a, SimpleInterval const& b) { return a._Add(b, false, false); }},
+        {"_Add nsw",      [](SimpleInterval const& a, SimpleInterval const& b) { return a._Add(b, false, true ); }},
+        {"_Sub",          [](SimpleInterval const& a, SimpleInterval const& b) { return a._Sub(b, false, false); }},
+        {"_Mul",          [](SimpleInterval const& a, SimpleInterval const& b) { return a._Mul(b, false, false); }},
+        {"_Mul nuw",      [](SimpleInterval const& a, SimpleInterval const& b) { return a._Mul(b, true,  false); }},
+        {"_UDiv",         [](SimpleInterval const& a, SimpleInterval const& b) { return a._UDiv(b); }},
+        {"_URem",         [](SimpleInterval const& a, SimpleInterval const& b) { return a._URem(b); }},
+        {"_SRem",         [](SimpleInterval const& a, SimpleInterval const& b) { return a._SRem(b); }},
+        {"_upperBound",   [](SimpleInterval const& a, SimpleInterval const& b) { return a._upperBound(b); }},
+        {"_widen",        [](SimpleInterval const& a, SimpleInterval const& b) { return a._widen(b); }},
+        {"_narrow",       [](SimpleInterval const& a, SimpleInterval const& b) { return a._narrow(b); }},
+        {"_refineBranch", [](SimpleInterval const& a, SimpleInterval const& b) {
+            static Predicate const preds[] = {
+                Predicate::ICMP_EQ,  Predicate::ICMP_NE,  Predicate::ICMP_SLT, Predicate::ICMP_SLE,
+                Predicate::ICMP_SGE, Predicate::ICMP_SGT, Predicate::ICMP_ULT, Predicate::ICMP_ULE,
+                Predicate::ICMP_UGE, Predicate::ICMP_UGT
+            };
+            pred_index = pred_index == 9 ? 0 : pred_index + 1;
+            return SimpleInterval::_refineBranch(preds[pred_index], a, b);
+        }},
+    };
+
+    std::vector<BenchInputs> inputs;
+    for (u32 w: widths) {
+        // Every width starts from the initial state of the test, so that the inputs do not depend
+        // on which widths are measured.
+        rand_state = 0xd1620b2a7a243d4bull;
+        inputs.push_back(generateInputs(w, input_count));
+    }
+
+    std::printf("%-14s", "ns/op");
+    for (u32 w: widths) std::printf(" %8s%-3d", "w=", (int)w);
+    std::printf("\n");
+
+    for (Operation const& i: operations) {
+        std::printf("%-14s", i.name);
+        for (BenchInputs const& j: inputs) {
+            std::printf(" %11.1f", measure(j, min_seconds, i.op));
+            std::fflush(stdout);
+        }
+        std::printf("\n");
+    }
+}
@@ -1,39 +1,28 @@
 
+#include <atomic>
+#include <chrono>
 #include <cstdio>
-#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "parallel.h"
 #include "simple_interval.h"
-
-// Standard integer types
-using s64 = std::int64_t;
-using u64 = std::uint64_t;
-using s32 = std::int32_t;
-using u32 = std::uint32_t;
-using s16 = std::int16_t;
-using u16 = std::uint16_t;
-using s8 = std::int8_t;
-using u8 = std::uint8_t;
-
+#include "widening_thresholds.h"
+#include "xorshift.h"
 
 namespace pcpo {
 
-static u64 rand_state = 0xd1620b2a7a243d4bull;
-u64 rand64() {
-    u64 x = rand_state;
-    x ^= x >> 12;
-    x ^= x << 25;
-    x ^= x >> 27;
-    rand_state = x;
-    return x * 0x2545f4914f6cdd1dull;
-}
-
-void testSimpleDomain(u32 w, u32 iters, u64* errs) {
+void testSimpleDomain(u32 w, u64 iters, u64* errs, u64* err_state) {
     // The test just does all the operations with random values and checks whether it outputs
     // something sensible. Of course, this cannot check whether something accidentally becomes top.
+    //  The inputs are drawn from rand_state of the calling thread. If an error is found, the state
+    // at the start of the failing iteration is written into err_state, and the test stops. Calling
+    // this again with that state and iters = 1 reproduces the error.
     
     using APInt = llvm::APInt;
-    
-    std::fprintf(stderr, "Checking width %2d using %6d iterations, rand_state = 0x%lxull\n", (int)w, (int)iters, rand_state);
 
     u64 mask = ((u64)-1) >> (64 - w);
     
@@ -46,17 +35,13 @@ void testSimpleDomain(u32 w, u32 iters, u64* errs) {
 
     SimpleInterval add0, add1, add2, sub0, sub1;
     SimpleInterval sub2, mul0, mul1, mul2, udiv;
-    SimpleInterval urem, srem, lub, glb;
+    SimpleInterval urem, srem, lub, glb, wid;
     SimpleInterval aeq, ane, aslt, asle, asge;
     SimpleInterval asgt, ault, aule, auge, augt;
     SimpleInterval beq, bne, bslt, bsle, bsge;
     SimpleInterval bsgt, bult, bule, buge, bugt;
     
-    for (s64 i = 0; i < iters; ++i) {
-        const s64 freq = 0x7ff;
-        if ((i&freq) == freq && i+1 != iters) {
-            std::fprintf(stderr, "iteration %d/%d, rand_state = 0x%lxull\n", (int)(i+1), (int)iters, rand_state);
-        }
+    for (u64 i = 0; i < iters; ++i) {
         u64 init_state = rand_state;
         u64 a_beg = rand64() & mask;
         u64 a_end = rand64() & mask;
@@ -124,6 +109,22 @@ void testSimpleDomain(u32 w, u32 iters, u64* errs) {
         srem = a_._SRem(b_)             ._makeTopSpecial();
         lub  = a_._upperBound(b_)       ._makeTopSpecial();
         glb  = a_._narrow(b_)           ._makeTopSpecial();
+
+        // Widen with a few thresholds, some of them close to the bounds, which is where _widen looks
+        // for them. In half of the iterations, there are none.
+        {
+            std::vector<APInt> compared, starts;
+            u64 count = flags >> 16 & 1 ? rand64() % 8 : 0;
+            u64 bounds[] = {a_beg, a_end, b_beg, b_end};
+            for (u64 j = 0; j < count; ++j) {
+                u64 near = bounds[rand64() % 4] + rand64() % 16 - 8;
+                (rand64() & 1 ? compared : starts).push_back(APInt {w, (rand64() & 1 ? rand64() : near) & mask});
+            }
+            WideningThresholds thresholds {compared, starts};
+            widening_thresholds = &thresholds;
+            wid = a_._widen(b_)._makeTopSpecial();
+            widening_thresholds = nullptr;
+        }
         aeq  = SimpleInterval::_refineBranch(llvm::CmpInst::Predicate::ICMP_EQ,  a_, b_)._makeTopSpecial();
         ane  = SimpleInterval::_refineBranch(llvm::CmpInst::Predicate::ICMP_NE,  a_, b_)._makeTopSpecial();
         aslt = SimpleInterval::_refineBranch(llvm::CmpInst::Predicate::ICMP_SLT, a_, b_)._makeTopSpecial();
@@ -150,6 +151,7 @@ void testSimpleDomain(u32 w, u32 iters, u64* errs) {
         *errs += (a.isTop() || b.isTop()) && !sub0.isTop();
         *errs += (a.isTop() || b.isTop()) && !lub.isTop();
         *errs += (a.isTop() && b.isTop()) && !glb.isTop();
+        *errs += !(lub <= wid);
 
 #define SANITY(x)                                                       \
         *errs += x.state == SimpleInterval::NORMAL && (                 \
@@ -157,7 +159,7 @@ void testSimpleDomain(u32 w, u32 iters, u64* errs) {
 
         SANITY(add0); SANITY(add1); SANITY(add2); SANITY(sub0); SANITY(sub1);
         SANITY(sub2); SANITY(mul0); SANITY(mul1); SANITY(mul2); SANITY(udiv);
-        SANITY(urem); SANITY(srem); SANITY(lub ); SANITY(glb );
+        SANITY(urem); SANITY(srem); SANITY(lub ); SANITY(glb ); SANITY(wid );
 
         SANITY(aeq ); SANITY(ane ); SANITY(aslt); SANITY(asle); SANITY(asge);
         SANITY(asgt); SANITY(ault); SANITY(aule); SANITY(auge); SANITY(augt);
@@ -196,6 +198,7 @@ void testSimpleDomain(u32 w, u32 iters, u64* errs) {
             *errs += !y.isNullValue() && !urem.contains(x.urem(y));
             *errs += !y.isNullValue() && !srem.contains(x.srem(y));
             *errs += !lub.contains(x) || !lub.contains(y);
+            *errs += !wid.contains(x) || !wid.contains(y);
             *errs += b.contains(x) && !glb.contains(x);
             *errs += a.contains(y) && !glb.contains(y);
             *errs += !a.contains(y) && glb.contains(y);
@@ -216,32 +219,162 @@ void testSimpleDomain(u32 w, u32 iters, u64* errs) {
 
         if (*errs) {
           err:
-            std::fprintf(stderr, "Error in iteration %d, rand_state = 0x%lxull\n", (int)i, init_state);
-            std::fprintf(stderr, "To debug this, please update the initial value for rand_state in main() and set a watchpoint to the global variable error_count.\n");
-            std::abort();
+            *err_state = init_state;
+            return;
+        }
+    }
+}
+
+// Widens the values of the loops in samples/for.c and samples/while-bigger-steps.c by hand, with
+// the thresholds WideningThresholds would collect for them. Returns the number of failed checks.
+u64 testWideningThresholds() {
+    using APInt = llvm::APInt;
+    auto interval = [](u64 begin, u64 end) { return SimpleInterval {APInt {32, begin}, APInt {32, end}}; };
+    auto widen = [](SimpleInterval const& a, SimpleInterval const& b) {
+        return SimpleInterval::merge(Merge_op::WIDEN, a, b);
+    };
+    u64 errs = 0;
+
+    // for (i = 0; i < 1000; ++i): The counter goes right to the bound with a single widening.
+    WideningThresholds counting {{APInt {32, 1000}}, {APInt {32, 0}}};
+    widening_thresholds = &counting;
+    errs += widen(interval(0, 0), interval(0, 1)) != interval(0, 1000);
+
+    // x = 0; while (x <= 80) x += 13: Once x is past the last threshold, this must not wrap around to
+    // the first one (i.e. the start of the loop), but widen as without thresholds.
+    WideningThresholds steps {{APInt {32, 80}}, {APInt {32, 0}}};
+    widening_thresholds = &steps;
+    errs += widen(interval(13, 13), interval(13, 26)) != interval(13, 80);
+    SimpleInterval past = widen(interval(13, 80), interval(13, 93));
+    widening_thresholds = nullptr;
+    errs += past != widen(interval(13, 80), interval(13, 93));
+
+    return errs;
+}
+
+// The result of testing a single shard
+struct ShardResult {
+    u64 iters = 0;     // Number of iterations that were run
+    u64 errs = 0;      // Number of failed checks
+    u64 err_state = 0; // rand_state at the start of the failing iteration, if errs != 0
+};
+
+// Tests width w on thread_count threads. The iterations are split into shards of shard_iters
+// iterations, each drawing from its own xorshift stream seeded from (seed, w, shard index). So the
+// inputs of a shard do not depend on the number of threads or on which thread runs it.
+//  If seconds is 0, exactly shard_count shards are run. Otherwise, shards are started until the time
+// is up, and the shards that have already started finish. Either way, the results are returned in
+// the order of the shards.
+std::vector<ShardResult> testShards(u32 w, u64 seed, u64 shard_iters, u64 shard_count, double seconds, int thread_count) {
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double> {seconds});
+
+    // The shards that each thread ran, with their indices
+    std::vector<std::vector<std::pair<u64, ShardResult>>> results (thread_count);
+    std::atomic<u64> next {0};
+    std::atomic<bool> failed {false};
+    parallelFor(thread_count, thread_count, [&](int thread) {
+        // Once an error was found, there is no need to start new shards. But a shard that was
+        // taken is always run, so that all shards before the first failing one are complete.
+        while (not failed) {
+            u64 shard = next++;
+            if (seconds == 0 ? shard >= shard_count : Clock::now() >= deadline) break;
+
+            ShardResult result;
+            rand_state = splitmix64(seed ^ (u64)w << 48 ^ shard);
+            testSimpleDomain(w, shard_iters, &result.errs, &result.err_state);
+            result.iters = shard_iters;
+            if (result.errs) failed = true;
+            results[thread].push_back({shard, result});
+        }
+    });
+
+    // Collect the shards in order. Shards that were not run have iters == 0.
+    std::vector<ShardResult> shards;
+    for (auto const& i: results) {
+        for (auto const& j: i) {
+            if (shards.size() <= j.first) shards.resize(j.first + 1);
+            shards[j.first] = j.second;
         }
     }
+    return shards;
 }
 
 } // end of namespace pcpo
 
 
-u64 error_count;
-int main() {
+int main(int argc, char** argv) {
     using namespace pcpo;
-    u64 iters = 64;
 
-    // Use this to reproduce a failing example more quickly. Simply insert the
-    // last random hash the script outputs and the correct bitwidth.
-    //rand_state = 0xe596fd2a27fe71c7ull;
-    //testSimpleDomain(16, iters, &error_count);
-    
-    while (true) {
-        testSimpleDomain( 8, iters, &error_count);
-        testSimpleDomain(16, iters, &error_count);
-        testSimpleDomain(17, iters, &error_count);
-        testSimpleDomain(32, iters, &error_count);
-        testSimpleDomain(64, iters, &error_count);
-        iters *= 2;
+    char const* usage =
+        "Usage: %s [-j threads] [-t seconds] [-s seed] [-r width state]\n"
+        "  -j  number of threads (default: all cores)\n"
+        "  -t  test each width for that many seconds, instead of forever with an increasing number of iterations\n"
+        "  -s  seed of the random inputs (default: 0x%lxull)\n"
+        "  -r  reproduce a single failing iteration, as reported by an earlier run\n";
+
+    int thread_count = std::max<int>(std::thread::hardware_concurrency(), 1);
+    double seconds = 0;
+    u64 seed = rand_state;
+    u32 repro_width = 0;
+    u64 repro_state = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (not std::strcmp(argv[i], "-j") and i+1 < argc) {
+            thread_count = std::max(std::atoi(argv[++i]), 1);
+        } else if (not std::strcmp(argv[i], "-t") and i+1 < argc) {
+            seconds = std::atof(argv[++i]);
+        } else if (not std::strcmp(argv[i], "-s") and i+1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (not std::strcmp(argv[i], "-r") and i+2 < argc) {
+            repro_width = std::atoi(argv[++i]);
+            repro_state = std::strtoull(argv[++i], nullptr, 0);
+        } else {
+            std::fprintf(stderr, usage, argv[0], seed);
+            return 2;
+        }
+    }
+
+    // Use this to reproduce a failing example more quickly. Set a breakpoint on the error in
+    // testSimpleDomain, or a watchpoint on errs.
+    if (repro_width) {
+        u64 errs = 0, err_state = 0;
+        rand_state = repro_state;
+        testSimpleDomain(repro_width, 1, &errs, &err_state);
+        std::fprintf(stderr, "Width %d, rand_state = 0x%lxull: %s\n", (int)repro_width, repro_state, errs ? "error" : "ok");
+        return errs ? 1 : 0;
+    }
+
+    if (u64 errs = testWideningThresholds()) {
+        std::fprintf(stderr, "Error: %d checks of the widening thresholds failed\n", (int)errs);
+        return 1;
+    }
+
+    u32 widths[] = {8, 16, 17, 32, 64};
+    constexpr u64 shard_iters = 64;
+
+    std::fprintf(stderr, "Using %d threads, seed = 0x%lxull\n", thread_count, seed);
+    for (u64 shard_count = 1; ; shard_count *= 2) {
+        for (u32 w: widths) {
+            if (seconds == 0) {
+                std::fprintf(stderr, "Checking width %2d using %8lu iterations\n", (int)w, shard_count * shard_iters);
+            }
+
+            std::vector<ShardResult> shards = testShards(w, seed, shard_iters, shard_count, seconds, thread_count);
+
+            u64 iters = 0;
+            for (u64 i = 0; i < shards.size(); ++i) {
+                iters += shards[i].iters;
+                if (not shards[i].errs) continue;
+
+                std::fprintf(stderr, "Error in width %d, shard %lu, rand_state = 0x%lxull\n", (int)w, i, shards[i].err_state);
+                std::fprintf(stderr, "To debug this, run %s -r %d 0x%lx\n", argv[0], (int)w, shards[i].err_state);
+                return 1;
+            }
+
+            if (seconds != 0) {
+                std::fprintf(stderr, "Checked width %2d using %10lu iterations in %.1f seconds\n", (int)w, iters, seconds);
+            }
+        }
+        if (seconds != 0) break;
     }
 }
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Standard integer types
+using s64 = std::int64_t;
+using u64 = std::uint64_t;
+using s32 = std::int32_t;
+using u32 = std::uint32_t;
+using s16 = std::int16_t;
+using u16 = std::uint16_t;
+using s8 = std::int8_t;
+using u8 = std::uint8_t;
+
+namespace pcpo {
+
+// The xorshift64* generator the tests and benchmarks use to produce their inputs. The state is
+// printed by the test, so that failing inputs can be reproduced by resetting it. Each thread has its
+// own state, so the test can run independent streams in parallel.
+static thread_local u64 rand_state = 0xd1620b2a7a243d4bull;
+inline u64 rand64() {
+    u64 x = rand_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rand_state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+// Turns an arbitrary seed into a good initial value for rand_state (which must not be 0). This is
+// the splitmix64 generator, which is commonly used to seed xorshift.
+inline u64 splitmix64(u64 x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x ? x : 0xd1620b2a7a243d4bull;
+}
+
+} // end of namespace pcpo